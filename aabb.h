@@ -0,0 +1,64 @@
+#pragma once
+#include "vec3.h"
+#include <float.h>
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+/**
+    @struct AABB
+
+    Axis aligned bounding box. A default constructed box is empty, and
+    growing it by anything makes it exactly that size.
+*/
+struct AABB
+{
+    vec3 min = { FLT_MAX, FLT_MAX, FLT_MAX };
+    vec3 max = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+};
+
+//------------------------------------------------------------------------------
+/**
+    grow box to contain point
+*/
+inline void
+grow(AABB& box, vec3 const& p)
+{
+    box.min = vec3(std::min(box.min.x, p.x), std::min(box.min.y, p.y), std::min(box.min.z, p.z));
+    box.max = vec3(std::max(box.max.x, p.x), std::max(box.max.y, p.y), std::max(box.max.z, p.z));
+}
+
+//------------------------------------------------------------------------------
+/**
+    grow box to contain another box
+*/
+inline void
+grow(AABB& box, AABB const& other)
+{
+    box.min = vec3(std::min(box.min.x, other.min.x), std::min(box.min.y, other.min.y), std::min(box.min.z, other.min.z));
+    box.max = vec3(std::max(box.max.x, other.max.x), std::max(box.max.y, other.max.y), std::max(box.max.z, other.max.z));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline vec3
+centroid(AABB const& box)
+{
+    return vec3((box.min.x + box.max.x) * 0.5f, (box.min.y + box.max.y) * 0.5f, (box.min.z + box.max.z) * 0.5f);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Surface area of box, or 0 if it is empty
+*/
+inline float
+area(AABB const& box)
+{
+    if (box.min.x > box.max.x)
+        return 0.0f;
+
+    scalar dx = box.max.x - box.min.x;
+    scalar dy = box.max.y - box.min.y;
+    scalar dz = box.max.z - box.min.z;
+    return (float)(2 * (dx * dy + dy * dz + dz * dx));
+}
@@ -0,0 +1,188 @@
+#include "accumulator.h"
+#include <math.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ACCUMULATOR_SSE 1
+#include <emmintrin.h>
+#endif
+
+static_assert(sizeof(Color) == 3 * sizeof(float), "Color must be three packed floats");
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Accumulator::Resize(unsigned width, unsigned height)
+{
+    this->means.assign(size_t(width) * height * 3, accum(0));
+    this->deviations.assign(size_t(width) * height, accum(0));
+    this->counts.assign(size_t(width) * height, 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Accumulator::Clear()
+{
+    std::fill(this->means.begin(), this->means.end(), accum(0));
+    std::fill(this->deviations.begin(), this->deviations.end(), accum(0));
+    std::fill(this->counts.begin(), this->counts.end(), 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+unsigned long long
+Accumulator::GetTotalCount() const
+{
+    unsigned long long total = 0;
+    for (unsigned count : this->counts)
+    {
+        total += count;
+    }
+    return total;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Accumulator::CopyMeans(std::vector<Color>& out) const
+{
+    const size_t count = this->means.size() / 3;
+    out.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = this->GetMean((unsigned)i);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Linear to sRGB without pow. The curve above the linear toe is fitted
+    with square roots (after Ian Taylor), off by less than half a step of
+    an 8 bit channel. The SIMD path uses the same fit, so both give the
+    same bytes.
+*/
+static inline float
+EncodeSRGB(float x)
+{
+    if (x <= 0.0031308f)
+        return x * 12.92f;
+    const float s1 = sqrtf(x);
+    const float s2 = sqrtf(s1);
+    const float s3 = sqrtf(s2);
+    return std::min(0.662002687f * s1 + 0.684122060f * s2 - 0.323583601f * s3 - 0.0225411470f * x, 1.0f);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static inline float
+ApplyTonemap(float x, Tonemap tonemap)
+{
+    // written so that NaN becomes 0, like max_ps in the SIMD path
+    x = x > 0.0f ? x : 0.0f;
+    switch (tonemap)
+    {
+    case TonemapReinhard:
+        return x / (1.0f + x);
+    case TonemapACES:
+        return std::min((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 1.0f);
+    default:
+        return std::min(x, 1.0f);
+    }
+}
+
+#if ACCUMULATOR_SSE
+//------------------------------------------------------------------------------
+/**
+*/
+static inline __m128
+Load4(float const* p)
+{
+    return _mm_loadu_ps(p);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static inline __m128
+Load4(double const* p)
+{
+    return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(p)), _mm_cvtpd_ps(_mm_loadu_pd(p + 2)));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static inline __m128
+ApplyTonemap4(__m128 x, Tonemap tonemap)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    x = _mm_max_ps(x, _mm_setzero_ps());
+    switch (tonemap)
+    {
+    case TonemapReinhard:
+        return _mm_div_ps(x, _mm_add_ps(one, x));
+    case TonemapACES:
+    {
+        __m128 num = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+        __m128 den = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+        return _mm_min_ps(_mm_div_ps(num, den), one);
+    }
+    default:
+        return _mm_min_ps(x, one);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static inline __m128
+EncodeSRGB4(__m128 x)
+{
+    const __m128 s1 = _mm_sqrt_ps(x);
+    const __m128 s2 = _mm_sqrt_ps(s1);
+    const __m128 s3 = _mm_sqrt_ps(s2);
+    __m128 curve = _mm_mul_ps(_mm_set1_ps(0.662002687f), s1);
+    curve = _mm_add_ps(curve, _mm_mul_ps(_mm_set1_ps(0.684122060f), s2));
+    curve = _mm_sub_ps(curve, _mm_mul_ps(_mm_set1_ps(0.323583601f), s3));
+    curve = _mm_sub_ps(curve, _mm_mul_ps(_mm_set1_ps(0.0225411470f), x));
+    curve = _mm_min_ps(curve, _mm_set1_ps(1.0f));
+    const __m128 toe = _mm_mul_ps(x, _mm_set1_ps(12.92f));
+    const __m128 isToe = _mm_cmple_ps(x, _mm_set1_ps(0.0031308f));
+    return _mm_or_ps(_mm_and_ps(isToe, toe), _mm_andnot_ps(isToe, curve));
+}
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    Every channel goes through the same curve, so the means are treated as
+    one flat array of floats, four at a time, without caring where a pixel
+    ends.
+*/
+void
+Accumulator::Resolve(Color* output, unsigned first, unsigned count, float exposure, Tonemap tonemap) const
+{
+    accum const* src = &this->means[size_t(first) * 3];
+    float* dst = &output->r;
+    const unsigned n = count * 3;
+    unsigned i = 0;
+
+#if ACCUMULATOR_SSE
+    const __m128 scale = _mm_set1_ps(exposure);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 x = _mm_mul_ps(Load4(src + i), scale);
+        _mm_storeu_ps(dst + i, EncodeSRGB4(ApplyTonemap4(x, tonemap)));
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+        dst[i] = EncodeSRGB(ApplyTonemap(float(src[i]) * exposure, tonemap));
+    }
+}
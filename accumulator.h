@@ -0,0 +1,117 @@
+#pragma once
+#include <math.h>
+#include <vector>
+#include "color.h"
+
+// the running means can be kept in double, for very long accumulations
+#if defined(TRAYRACER_DOUBLE_ACCUMULATION)
+typedef double accum;
+#else
+typedef float accum;
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    Curve applied to the exposed linear color before it is encoded as sRGB
+*/
+enum Tonemap
+{
+    // clip at 1, what the viewer always did
+    TonemapClamp,
+    // x / (1 + x)
+    TonemapReinhard,
+    // Narkowicz' fit of the ACES filmic curve
+    TonemapACES
+};
+
+//------------------------------------------------------------------------------
+/**
+    Progressive accumulation of frames. Every pixel stores the running mean
+    of the frames added so far, so the stored values never grow and can be
+    shown at any time. Resolving turns means into display ready sRGB in one
+    pass, without a copy in between.
+
+    Pixels keep their own frame count, so some can stop receiving frames
+    while others go on. Alongside the mean, Welford's running sum of squared
+    deviations of the luminance is kept, which tells how noisy a pixel still is.
+*/
+class Accumulator
+{
+public:
+    // set the size in pixels, clears everything
+    void Resize(unsigned width, unsigned height);
+
+    // forget all frames
+    void Clear();
+
+    // fold the estimate of a pixel from one more frame into its mean
+    void Add(unsigned pixel, Color const& color);
+
+    // exposed, tonemapped and sRGB encoded means of count pixels starting at first
+    void Resolve(Color* output, unsigned first, unsigned count, float exposure, Tonemap tonemap) const;
+
+    // linear mean of a pixel
+    Color GetMean(unsigned pixel) const;
+
+    // frames added to a pixel
+    unsigned GetCount(unsigned pixel) const;
+
+    // frames added, summed over all pixels
+    unsigned long long GetTotalCount() const;
+
+    // standard error of the pixel's mean luminance, divided by the square
+    // root of that mean so dark and bright pixels are held to what is
+    // visible in them. Infinite with fewer than two frames
+    float GetError(unsigned pixel) const;
+
+    // linear means of all pixels, for writing HDR images
+    void CopyMeans(std::vector<Color>& out) const;
+
+private:
+    // r, g, b per pixel
+    std::vector<accum> means;
+    // sum of squared deviations from the mean luminance per pixel
+    std::vector<accum> deviations;
+    std::vector<unsigned> counts;
+};
+
+// Rec. 709 luminance
+inline accum Luminance(accum r, accum g, accum b)
+{
+    return accum(0.2126) * r + accum(0.7152) * g + accum(0.0722) * b;
+}
+
+inline void Accumulator::Add(unsigned pixel, Color const& color)
+{
+    accum* mean = &this->means[pixel * 3];
+    const unsigned count = ++this->counts[pixel];
+    const accum weight = accum(1) / accum(count);
+    const accum oldLuminance = Luminance(mean[0], mean[1], mean[2]);
+    mean[0] += (accum(color.r) - mean[0]) * weight;
+    mean[1] += (accum(color.g) - mean[1]) * weight;
+    mean[2] += (accum(color.b) - mean[2]) * weight;
+    const accum luminance = Luminance(accum(color.r), accum(color.g), accum(color.b));
+    this->deviations[pixel] += (luminance - oldLuminance) * (luminance - Luminance(mean[0], mean[1], mean[2]));
+}
+
+inline Color Accumulator::GetMean(unsigned pixel) const
+{
+    accum const* mean = &this->means[pixel * 3];
+    return { float(mean[0]), float(mean[1]), float(mean[2]) };
+}
+
+inline unsigned Accumulator::GetCount(unsigned pixel) const
+{
+    return this->counts[pixel];
+}
+
+inline float Accumulator::GetError(unsigned pixel) const
+{
+    const unsigned count = this->counts[pixel];
+    if (count < 2)
+        return INFINITY;
+    accum const* mean = &this->means[pixel * 3];
+    const accum variance = this->deviations[pixel] / accum(count - 1);
+    const accum luminance = Luminance(mean[0], mean[1], mean[2]);
+    return float(sqrt(variance / accum(count)) / sqrt(luminance > accum(1e-4) ? luminance : accum(1e-4)));
+}
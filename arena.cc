@@ -0,0 +1,60 @@
+#include "arena.h"
+#include <stdint.h>
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+/**
+*/
+Arena::Arena(size_t blockSize) :
+    blockSize(blockSize)
+{
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Arena::~Arena()
+{
+    this->Clear();
+}
+
+//------------------------------------------------------------------------------
+/**
+    Allocations larger than a block get a block of their own.
+*/
+void*
+Arena::Allocate(size_t size, size_t alignment)
+{
+    size_t padding = (alignment - (uintptr_t)this->current % alignment) % alignment;
+    if (this->current == nullptr || padding + size > this->remaining)
+    {
+        // operator new aligns less strictly than we may need, so leave room to align inside the block
+        const size_t bytes = std::max(this->blockSize, size + alignment);
+        this->current = (char*)::operator new(bytes);
+        this->remaining = bytes;
+        this->blocks.push_back(this->current);
+        padding = (alignment - (uintptr_t)this->current % alignment) % alignment;
+    }
+
+    char* memory = this->current + padding;
+    this->current += padding + size;
+    this->remaining -= padding + size;
+    this->used += size;
+    return memory;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Arena::Clear()
+{
+    for (char* block : this->blocks)
+    {
+        ::operator delete(block);
+    }
+    this->blocks.clear();
+    this->current = nullptr;
+    this->remaining = 0;
+    this->used = 0;
+}
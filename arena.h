@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <vector>
+
+//------------------------------------------------------------------------------
+/**
+    Bump allocator handing out memory from large blocks.
+
+    Allocations that follow each other end up next to each other in memory,
+    and nothing is ever freed on its own: Clear releases every block in one
+    go. Destructors are not run, objects that need one have to be destroyed
+    by whoever created them before the arena is cleared.
+*/
+class Arena
+{
+public:
+    Arena(size_t blockSize = 64 * 1024);
+    ~Arena();
+    Arena(Arena const&) = delete;
+    Arena& operator=(Arena const&) = delete;
+
+    // get size bytes aligned to alignment, which must be a power of two
+    void* Allocate(size_t size, size_t alignment);
+
+    // construct a T in the arena
+    template<class T, class... ARGS> T* New(ARGS&&... args);
+
+    // release every block
+    void Clear();
+
+    // bytes handed out since the last Clear
+    size_t GetBytesUsed() const;
+
+private:
+    std::vector<char*> blocks;
+    char* current = nullptr;
+    size_t remaining = 0;
+    size_t used = 0;
+    const size_t blockSize;
+};
+
+template<class T, class... ARGS> inline T* Arena::New(ARGS&&... args)
+{
+    return new (this->Allocate(sizeof(T), alignof(T))) T(std::forward<ARGS>(args)...);
+}
+inline size_t Arena::GetBytesUsed() const
+{
+    return this->used;
+}
@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "raytracer.h"
+#include "scenes.h"
+#include "flags.h"
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+PrintUsage()
+{
+    printf("usage: trayracer-bench [options]\n"
+           "  --width <n>          image width (default 320)\n"
+           "  --height <n>         image height (default 180)\n"
+           "  --rpp <n>            rays per pixel and frame (default 1)\n"
+           "  --bounces <n>        max bounces per path (default 5)\n"
+           "  --roulette-depth <n> bounces before Russian roulette may end a path (default 3)\n"
+           "  --frames <n>         frames timed per measurement (default 4)\n"
+           "  --scenes <a,b,..>    built in scenes to measure\n"
+           "                       (default spheres,spheres10k,spheres1m,glass,metal)\n"
+           "  --scaling-scene <n>  scene the thread scaling curve is measured on (default spheres10k)\n"
+           "  --threads <a,b,..>   thread counts of the scaling curve (default 1, 2, 4, .. up to all)\n"
+           "  --kernel <name>      sphere intersection kernel, scalar, sse2 or avx2 (default the\n"
+           "                       widest this cpu runs)\n"
+           "  --output <path>      write the JSON there instead of to stdout\n");
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+struct BenchConfig
+{
+    unsigned width;
+    unsigned height;
+    unsigned rpp;
+    unsigned bounces;
+    unsigned rouletteDepth;
+    unsigned frames;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Numbers measured on one scene at one thread count
+*/
+struct BenchResult
+{
+    unsigned threads = 0;
+    unsigned spheres = 0;
+    unsigned objects = 0;
+    double buildSeconds = 0;
+    // camera rays only, traced with bounces set to 0
+    double primaryRaysPerSecond = 0;
+    // full paths, one per pixel sample
+    double pathsPerSecond = 0;
+    // every ray cast while tracing the paths, bounces included
+    double raysPerSecond = 0;
+    // share of the paths that Russian roulette ended
+    double rouletteFraction = 0;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+static std::vector<std::string>
+SplitList(std::string const& list)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        if (end > start)
+            items.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Trace config.frames frames and return the seconds they took
+*/
+static double
+TimeFrames(Raytracer& rt, BenchConfig const& config)
+{
+    rt.Clear();
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (unsigned frame = 0; frame < config.frames; ++frame)
+    {
+        rt.Raytrace();
+    }
+    auto endTime = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(endTime - startTime).count();
+}
+
+//------------------------------------------------------------------------------
+/**
+    The scene is built from scratch for every run, the BVH build is timed
+    along with it and left out of the tracing numbers.
+*/
+static bool
+RunScene(std::string const& scene, unsigned threads, bool primary, BenchConfig const& config, BenchResult& result)
+{
+    std::vector<Color> framebuffer(config.width * config.height);
+    Raytracer rt(config.width, config.height, framebuffer, config.rpp, config.bounces, threads);
+    rt.rouletteDepth = config.rouletteDepth;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    if (!CreateScene(rt, scene))
+        return false;
+    rt.UpdateAccelerationStructure();
+    auto endTime = std::chrono::high_resolution_clock::now();
+
+    // same starting camera as the viewer
+    mat4 cameraTransform = multiply(rotationy(0), rotationx(0));
+    cameraTransform.m30 = 0.0f;
+    cameraTransform.m31 = 1.0f;
+    cameraTransform.m32 = 10.0f;
+    rt.SetViewMatrix(cameraTransform);
+
+    result.threads = rt.threadCount;
+    result.spheres = rt.spheres.Size();
+    result.objects = (unsigned)rt.objects.size();
+    result.buildSeconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    // wakes the workers up and pulls the scene into cache
+    rt.Raytrace();
+
+    const double samples = double(config.width) * config.height * config.rpp * config.frames;
+    if (primary)
+    {
+        rt.bounces = 0;
+        result.primaryRaysPerSecond = samples / TimeFrames(rt, config);
+        rt.bounces = config.bounces;
+    }
+
+    const unsigned long long raysBefore = rt.GetRayCount();
+    const unsigned long long rouletteBefore = rt.GetRouletteCount();
+    const double seconds = TimeFrames(rt, config);
+    result.pathsPerSecond = samples / seconds;
+    result.raysPerSecond = double(rt.GetRayCount() - raysBefore) / seconds;
+    result.rouletteFraction = double(rt.GetRouletteCount() - rouletteBefore) / samples;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Measures every scene on all hardware threads, and one scene across thread
+    counts. Progress goes to stderr, the results are printed as JSON so they
+    can be tracked from one release to the next.
+*/
+int
+main(int argc, char* argv[])
+{
+    flags::args arguments = flags::args(argc, argv);
+
+    if (arguments.get<bool>("help", false))
+    {
+        PrintUsage();
+        return 0;
+    }
+
+    const int w = arguments.get<int>("width", 320);
+    const int h = arguments.get<int>("height", 180);
+    const int raysPerPixel = arguments.get<int>("rpp", 1);
+    const int maxBounces = arguments.get<int>("bounces", 5);
+    const int rouletteDepth = arguments.get<int>("roulette-depth", 3);
+    const int frames = arguments.get<int>("frames", 4);
+    const std::vector<std::string> scenes = SplitList(arguments.get<std::string>("scenes", "spheres,spheres10k,spheres1m,glass,metal"));
+    const std::string scalingScene = arguments.get<std::string>("scaling-scene", "spheres10k");
+    const std::string kernelName = arguments.get<std::string>("kernel", "");
+    const std::string output = arguments.get<std::string>("output", "");
+
+    if (w <= 0 || h <= 0 || raysPerPixel <= 0 || maxBounces < 0 || frames <= 0 || rouletteDepth < 0)
+    {
+        fprintf(stderr, "width, height, rpp and frames must be positive, bounces and roulette-depth not negative\n");
+        PrintUsage();
+        return 1;
+    }
+
+    const unsigned hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<unsigned> threadCounts;
+    const std::string threadList = arguments.get<std::string>("threads", "");
+    if (threadList.empty())
+    {
+        for (unsigned threads = 1; threads < hardwareThreads; threads *= 2)
+        {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(hardwareThreads);
+    }
+    else
+    {
+        for (std::string const& item : SplitList(threadList))
+        {
+            const int threads = atoi(item.c_str());
+            if (threads <= 0)
+            {
+                fprintf(stderr, "bad thread count '%s'\n", item.c_str());
+                return 1;
+            }
+            threadCounts.push_back((unsigned)threads);
+        }
+    }
+
+    if (!kernelName.empty() && !SphereStore::SetKernel(kernelName))
+    {
+        fprintf(stderr, "unknown sphere kernel '%s', or this cpu can't run it\n", kernelName.c_str());
+        return 1;
+    }
+
+#ifndef NDEBUG
+    fprintf(stderr, "warning: not a release build, configure with -DCMAKE_BUILD_TYPE=Release for numbers worth tracking\n");
+#endif
+
+    BenchConfig config;
+    config.width = w;
+    config.height = h;
+    config.rpp = raysPerPixel;
+    config.bounces = maxBounces;
+    config.rouletteDepth = rouletteDepth;
+    config.frames = frames;
+
+    std::vector<BenchResult> sceneResults(scenes.size());
+    for (size_t i = 0; i < scenes.size(); ++i)
+    {
+        fprintf(stderr, "%s...\n", scenes[i].c_str());
+        if (!RunScene(scenes[i], 0, true, config, sceneResults[i]))
+        {
+            fprintf(stderr, "unknown scene '%s'\n", scenes[i].c_str());
+            return 1;
+        }
+    }
+
+    std::vector<BenchResult> scalingResults(threadCounts.size());
+    for (size_t i = 0; i < threadCounts.size(); ++i)
+    {
+        fprintf(stderr, "%s on %u threads...\n", scalingScene.c_str(), threadCounts[i]);
+        if (!RunScene(scalingScene, threadCounts[i], false, config, scalingResults[i]))
+        {
+            fprintf(stderr, "unknown scene '%s'\n", scalingScene.c_str());
+            return 1;
+        }
+    }
+
+    FILE* file = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "could not write '%s'\n", output.c_str());
+        return 1;
+    }
+
+#ifdef TRAYRACER_DOUBLE_PRECISION
+    const char* precision = "double";
+#else
+    const char* precision = "float";
+#endif
+    // numbers from a debug build are not worth comparing
+#ifdef NDEBUG
+    const char* build = "release";
+#else
+    const char* build = "debug";
+#endif
+    fprintf(file, "{\n");
+    fprintf(file, "  \"config\": {\"width\": %u, \"height\": %u, \"rpp\": %u, \"bounces\": %u, \"roulette_depth\": %u, \"frames\": %u, "
+        "\"hardware_threads\": %u, \"sphere_kernel\": \"%s\", \"precision\": \"%s\", \"build\": \"%s\"},\n",
+        config.width, config.height, config.rpp, config.bounces, config.rouletteDepth, config.frames, hardwareThreads, SphereStore::GetKernelName(), precision, build);
+
+    fprintf(file, "  \"scenes\": [\n");
+    for (size_t i = 0; i < scenes.size(); ++i)
+    {
+        BenchResult const& r = sceneResults[i];
+        fprintf(file, "    {\"name\": \"%s\", \"spheres\": %u, \"objects\": %u, \"threads\": %u, \"build_seconds\": %.4f, "
+            "\"primary_rays_per_sec\": %.0f, \"paths_per_sec\": %.0f, \"rays_per_sec\": %.0f, \"samples_per_sec_per_core\": %.0f, \"roulette_fraction\": %.4f}%s\n",
+            scenes[i].c_str(), r.spheres, r.objects, r.threads, r.buildSeconds,
+            r.primaryRaysPerSecond, r.pathsPerSecond, r.raysPerSecond, r.pathsPerSecond / r.threads, r.rouletteFraction,
+            i + 1 < scenes.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+
+    // speedup is relative to the first thread count measured
+    fprintf(file, "  \"scaling\": {\"scene\": \"%s\", \"points\": [\n", scalingScene.c_str());
+    for (size_t i = 0; i < scalingResults.size(); ++i)
+    {
+        BenchResult const& r = scalingResults[i];
+        const double speedup = r.pathsPerSecond / scalingResults[0].pathsPerSecond;
+        const double ideal = double(r.threads) / scalingResults[0].threads;
+        fprintf(file, "    {\"threads\": %u, \"paths_per_sec\": %.0f, \"samples_per_sec_per_core\": %.0f, \"speedup\": %.3f, \"efficiency\": %.3f}%s\n",
+            r.threads, r.pathsPerSecond, r.pathsPerSecond / r.threads, speedup, speedup / ideal,
+            i + 1 < scalingResults.size() ? "," : "");
+    }
+    fprintf(file, "  ]}\n");
+    fprintf(file, "}\n");
+
+    if (file != stdout)
+        fclose(file);
+    return 0;
+}
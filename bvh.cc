@@ -0,0 +1,217 @@
+#include "bvh.h"
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::Clear()
+{
+    this->nodes.clear();
+    this->indices.clear();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::Build(std::vector<AABB> const& bounds)
+{
+    this->Clear();
+    const unsigned count = (unsigned)bounds.size();
+    if (count == 0)
+        return;
+
+    this->indices.resize(count);
+    std::vector<vec3> centroids(count);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        this->indices[i] = i;
+        centroids[i] = centroid(bounds[i]);
+    }
+
+    // a binary tree with n leaves never has more than 2n - 1 nodes,
+    // so the node array won't move around while we build it
+    this->nodes.reserve(count * 2);
+    this->nodes.push_back(BVHNode());
+    this->nodes[0].leftFirst = 0;
+    this->nodes[0].count = count;
+    this->UpdateBounds(0, bounds);
+    this->Subdivide(0, bounds, centroids, 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Children always come after their parent, which rules out cycles and
+    lets the depth of every node be found in one pass front to back.
+*/
+bool
+BVH::IsValid(BVHNode const* nodes, unsigned nodeCount, unsigned primitiveCount)
+{
+    if (nodeCount == 0)
+        return primitiveCount == 0;
+
+    std::vector<unsigned> depths(nodeCount, 0);
+    for (unsigned i = 0; i < nodeCount; ++i)
+    {
+        BVHNode const& node = nodes[i];
+        if (node.IsLeaf())
+        {
+            if ((uint64_t)node.leftFirst + node.count > primitiveCount)
+                return false;
+        }
+        else
+        {
+            if (node.leftFirst <= i || (uint64_t)node.leftFirst + 1 >= nodeCount || depths[i] + 1 >= MaxDepth)
+                return false;
+            depths[node.leftFirst] = depths[i] + 1;
+            depths[node.leftFirst + 1] = depths[i] + 1;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::UpdateBounds(unsigned nodeIndex, std::vector<AABB> const& bounds)
+{
+    BVHNode& node = this->nodes[nodeIndex];
+    AABB box;
+    for (unsigned i = node.leftFirst; i < node.leftFirst + node.count; ++i)
+    {
+        grow(box, bounds[this->indices[i]]);
+    }
+    node.min[0] = (float)box.min.x;
+    node.min[1] = (float)box.min.y;
+    node.min[2] = (float)box.min.z;
+    node.max[0] = (float)box.max.x;
+    node.max[1] = (float)box.max.y;
+    node.max[2] = (float)box.max.z;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Binned SAH split. Primitives are binned by centroid along each axis, and
+    the cheapest of the BinCount - 1 candidate planes per axis is compared
+    against the cost of just keeping the node as a leaf.
+*/
+void
+BVH::Subdivide(unsigned nodeIndex, std::vector<AABB> const& bounds, std::vector<vec3> const& centroids, unsigned depth)
+{
+    const unsigned first = this->nodes[nodeIndex].leftFirst;
+    const unsigned count = this->nodes[nodeIndex].count;
+    if (count <= 1 || depth + 1 >= MaxDepth)
+        return;
+
+    AABB centroidBounds;
+    for (unsigned i = first; i < first + count; ++i)
+    {
+        grow(centroidBounds, centroids[this->indices[i]]);
+    }
+
+    int bestAxis = -1;
+    unsigned bestSplit = 0;
+    float bestCost = FLT_MAX;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const scalar lo = (&centroidBounds.min.x)[axis];
+        const scalar hi = (&centroidBounds.max.x)[axis];
+        if (hi <= lo)
+            continue;
+
+        AABB binBounds[BinCount];
+        unsigned binCount[BinCount] = {};
+        const scalar scale = BinCount / (hi - lo);
+        for (unsigned i = first; i < first + count; ++i)
+        {
+            unsigned prim = this->indices[i];
+            unsigned bin = std::min(BinCount - 1, (unsigned)(((&centroids[prim].x)[axis] - lo) * scale));
+            binCount[bin]++;
+            grow(binBounds[bin], bounds[prim]);
+        }
+
+        // sweep from both sides to get the area and count left and right of every plane
+        float leftArea[BinCount - 1];
+        unsigned leftCount[BinCount - 1];
+        AABB box;
+        unsigned sum = 0;
+        for (unsigned i = 0; i < BinCount - 1; ++i)
+        {
+            sum += binCount[i];
+            grow(box, binBounds[i]);
+            leftCount[i] = sum;
+            leftArea[i] = area(box);
+        }
+        box = AABB();
+        sum = 0;
+        for (unsigned i = BinCount - 1; i > 0; --i)
+        {
+            sum += binCount[i];
+            grow(box, binBounds[i]);
+            float cost = leftCount[i - 1] * leftArea[i - 1] + sum * area(box);
+            if (leftCount[i - 1] > 0 && sum > 0 && cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    // every centroid in the same spot, no plane can split this
+    if (bestAxis == -1)
+        return;
+
+    AABB nodeBounds;
+    BVHNode const& node = this->nodes[nodeIndex];
+    nodeBounds.min = vec3(node.min[0], node.min[1], node.min[2]);
+    nodeBounds.max = vec3(node.max[0], node.max[1], node.max[2]);
+    // splitting costs one extra node visit, in units of primitive tests
+    const float nodeArea = area(nodeBounds);
+    const float leafCost = count * nodeArea;
+    if (bestCost + nodeArea >= leafCost && count <= MaxLeafSize)
+        return;
+
+    // partition primitive indices around the chosen plane
+    const scalar lo = (&centroidBounds.min.x)[bestAxis];
+    const scalar hi = (&centroidBounds.max.x)[bestAxis];
+    const scalar scale = BinCount / (hi - lo);
+    unsigned i = first;
+    unsigned j = first + count - 1;
+    while (i <= j)
+    {
+        unsigned bin = std::min(BinCount - 1, (unsigned)(((&centroids[this->indices[i]].x)[bestAxis] - lo) * scale));
+        if (bin < bestSplit)
+        {
+            i++;
+        }
+        else
+        {
+            std::swap(this->indices[i], this->indices[j]);
+            if (j == 0)
+                break;
+            j--;
+        }
+    }
+
+    const unsigned leftCount = i - first;
+    if (leftCount == 0 || leftCount == count)
+        return;
+
+    const unsigned left = (unsigned)this->nodes.size();
+    this->nodes.push_back(BVHNode());
+    this->nodes.push_back(BVHNode());
+    this->nodes[left].leftFirst = first;
+    this->nodes[left].count = leftCount;
+    this->nodes[left + 1].leftFirst = i;
+    this->nodes[left + 1].count = count - leftCount;
+    this->nodes[nodeIndex].leftFirst = left;
+    this->nodes[nodeIndex].count = 0;
+
+    this->UpdateBounds(left, bounds);
+    this->UpdateBounds(left + 1, bounds);
+    this->Subdivide(left, bounds, centroids, depth + 1);
+    this->Subdivide(left + 1, bounds, centroids, depth + 1);
+}
@@ -0,0 +1,226 @@
+#pragma once
+#include <vector>
+#include <float.h>
+#include "aabb.h"
+#include "ray.h"
+#include "profile.h"
+
+//------------------------------------------------------------------------------
+/**
+    @struct BVHNode
+
+    32 byte node, two of them share a cache line. Interior nodes keep their
+    children next to each other at leftFirst and leftFirst + 1, leaves
+    reference count primitives starting at leftFirst in BVH::indices.
+*/
+struct BVHNode
+{
+    float min[3];
+    unsigned leftFirst;
+    float max[3];
+    unsigned count;
+
+    bool IsLeaf() const { return this->count > 0; }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Bounding volume hierarchy over a set of primitive bounds, built with
+    binned SAH and stored as a flat array of nodes in depth first order.
+
+    The BVH does not know what the primitives are; leaves hand primitive
+    indices back to a callback that does the actual intersection.
+*/
+class BVH
+{
+public:
+    // build the hierarchy from scratch over primitive bounds
+    void Build(std::vector<AABB> const& bounds);
+
+    // forget everything
+    void Clear();
+
+    // traverse front to back, calling leaf(first, count, tMax) for every leaf
+    // the ray reaches, where [first, first + count) is a range in indices.
+    // leaf returns true on a hit and shrinks tMax to the hit distance
+    template<class LEAF> bool Intersect(Ray const& ray, float& tMax, LEAF&& leaf) const;
+
+    // true as soon as any leaf reports a hit nearer than tMax. Leaves come
+    // in no particular order, for shadow rays that only ask if something is
+    // in the way
+    template<class LEAF> bool IntersectAny(Ray const& ray, float tMax, LEAF&& leaf) const;
+
+    bool IsEmpty() const;
+
+    // true if nodes read from outside, e.g. a scene file, can be traversed
+    // safely: leaves stay within primitiveCount, interior nodes point to
+    // children further down the array and no deeper than the traversal stack
+    static bool IsValid(BVHNode const* nodes, unsigned nodeCount, unsigned primitiveCount);
+
+    std::vector<BVHNode> nodes;
+    // primitive indices, in leaf order
+    std::vector<unsigned> indices;
+
+private:
+    // leaves are never made larger than this unless the primitives can't be told apart
+    static constexpr unsigned MaxLeafSize = 4;
+    // number of SAH bins per axis
+    static constexpr unsigned BinCount = 16;
+    // traversal stack size, and thus max tree depth
+    static constexpr unsigned MaxDepth = 64;
+
+    void UpdateBounds(unsigned node, std::vector<AABB> const& bounds);
+    void Subdivide(unsigned node, std::vector<AABB> const& bounds, std::vector<vec3> const& centroids, unsigned depth);
+};
+
+// the exit distance of a slab test is scaled by 1 + 2 * gamma(3) so that
+// rounding never culls a ray grazing a node, see Ize, "Robust BVH Ray Traversal"
+static constexpr float SlabExitScale = 1.00000036f;
+
+//------------------------------------------------------------------------------
+/**
+    slab test, returns entry distance or FLT_MAX on a miss. Conservative, so
+    a ray through the edge of a flat node (such as a leaf of coplanar
+    triangles) is never lost between its neighbours
+*/
+inline float
+IntersectNode(BVHNode const& node, float const origin[3], float const invDir[3], float tMax)
+{
+    float tx0 = (node.min[0] - origin[0]) * invDir[0];
+    float tx1 = (node.max[0] - origin[0]) * invDir[0];
+    float tmin = std::min(tx0, tx1);
+    float tmax = std::max(tx0, tx1);
+    float ty0 = (node.min[1] - origin[1]) * invDir[1];
+    float ty1 = (node.max[1] - origin[1]) * invDir[1];
+    tmin = std::max(tmin, std::min(ty0, ty1));
+    tmax = std::min(tmax, std::max(ty0, ty1));
+    float tz0 = (node.min[2] - origin[2]) * invDir[2];
+    float tz1 = (node.max[2] - origin[2]) * invDir[2];
+    tmin = std::max(tmin, std::min(tz0, tz1));
+    tmax = std::min(tmax, std::max(tz0, tz1));
+
+    if (tmax * SlabExitScale >= tmin && tmin < tMax && tmax > 0.0f)
+        return tmin;
+    return FLT_MAX;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline bool
+BVH::IsEmpty() const
+{
+    return this->nodes.empty();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<class LEAF>
+inline bool
+BVH::Intersect(Ray const& ray, float& tMax, LEAF&& leaf) const
+{
+    if (this->nodes.empty())
+        return false;
+
+    const float origin[3] = { (float)ray.b.x, (float)ray.b.y, (float)ray.b.z };
+    const float invDir[3] = { 1.0f / (float)ray.m.x, 1.0f / (float)ray.m.y, 1.0f / (float)ray.m.z };
+
+    if (IntersectNode(this->nodes[0], origin, invDir, tMax) == FLT_MAX)
+        return false;
+
+    struct Entry
+    {
+        unsigned node;
+        float t;
+    };
+    Entry stack[MaxDepth];
+    unsigned stackSize = 0;
+    unsigned current = 0;
+    bool isHit = false;
+
+    while (true)
+    {
+        BVHNode const& node = this->nodes[current];
+        PROFILE_COUNT(CounterNodesVisited, 1);
+        if (node.IsLeaf())
+        {
+            isHit |= leaf(node.leftFirst, node.count, tMax);
+        }
+        else
+        {
+            unsigned near = node.leftFirst;
+            unsigned far = node.leftFirst + 1;
+            float tNear = IntersectNode(this->nodes[near], origin, invDir, tMax);
+            float tFar = IntersectNode(this->nodes[far], origin, invDir, tMax);
+            if (tFar < tNear)
+            {
+                std::swap(near, far);
+                std::swap(tNear, tFar);
+            }
+
+            if (tNear != FLT_MAX)
+            {
+                if (tFar != FLT_MAX)
+                    stack[stackSize++] = { far, tFar };
+                current = near;
+                continue;
+            }
+        }
+
+        // pop the next node that is still closer than the closest hit
+        bool found = false;
+        while (stackSize > 0)
+        {
+            Entry entry = stack[--stackSize];
+            if (entry.t < tMax)
+            {
+                current = entry.node;
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            break;
+    }
+
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<class LEAF>
+inline bool
+BVH::IntersectAny(Ray const& ray, float tMax, LEAF&& leaf) const
+{
+    if (this->nodes.empty())
+        return false;
+
+    const float origin[3] = { (float)ray.b.x, (float)ray.b.y, (float)ray.b.z };
+    const float invDir[3] = { 1.0f / (float)ray.m.x, 1.0f / (float)ray.m.y, 1.0f / (float)ray.m.z };
+
+    unsigned stack[MaxDepth];
+    unsigned stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        BVHNode const& node = this->nodes[stack[--stackSize]];
+        PROFILE_COUNT(CounterNodesVisited, 1);
+        if (IntersectNode(node, origin, invDir, tMax) == FLT_MAX)
+            continue;
+
+        if (node.IsLeaf())
+        {
+            if (leaf(node.leftFirst, node.count, tMax))
+                return true;
+        }
+        else
+        {
+            stack[stackSize++] = node.leftFirst + 1;
+            stack[stackSize++] = node.leftFirst;
+        }
+    }
+    return false;
+}
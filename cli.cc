@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "raytracer.h"
+#include "scenes.h"
+#include "image.h"
+#include "scenefile.h"
+#include "profile.h"
+#include "flags.h"
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+PrintUsage()
+{
+    printf("usage: trayracer-cli [options]\n"
+           "  --width <n>       image width (default 500)\n"
+           "  --height <n>      image height (default 300)\n"
+           "  --rpp <n>         rays per pixel and frame (default 1)\n"
+           "  --bounces <n>     max bounces per path (default 5)\n"
+           "  --roulette-depth <n>  bounces before Russian roulette may end a path, above\n"
+           "                    --bounces turns it off (default 3)\n"
+           "  --frames <n>      frames to accumulate (default 16), at most that many with --noise\n"
+           "  --noise <x>       stop tracing tiles once their relative noise is below x, and\n"
+           "                    stop rendering once all are, e.g. 0.01 (default 0, off)\n"
+           "  --scene <name>    spheres, manyspheres, spheres10k, spheres1m, glass, metal,\n"
+           "                    instances, lights or a scene file (default spheres)\n"
+           "  --save-scene <path>  write the scene to a file before rendering, binary if the\n"
+           "                    path ends in .trb, text otherwise. Nothing is rendered with --frames 0.\n"
+           "                    Spheres and materials only, scenes with meshes can't be saved\n"
+           "  --sample-lights <yes|no>  sample lights directly at every bounce (default yes)\n"
+           "  --sampler <name>  independent, sobol, halton or bluenoise (default sobol)\n"
+           "  --kernel <name>   sphere intersection kernel, scalar, sse2 or avx2 (default the\n"
+           "                    widest this cpu runs)\n"
+           "  --exposure <x>    scale applied before tonemapping (default 1)\n"
+           "  --tonemap <name>  clamp, reinhard or aces (default clamp)\n"
+           "  --output <path>   image to write, .ppm, .png, .pfm or .exr (default render.ppm)\n"
+           "                    .pfm and .exr store linear float color, before exposure and tonemapping\n"
+           "  --stats <n>       print counters and timers every n frames, needs a TRAYRACER_PROFILE build\n"
+           "  --profile <path>  write a Chrome trace of the render, needs a TRAYRACER_PROFILE build\n");
+}
+
+//------------------------------------------------------------------------------
+/**
+    Renders a fixed number of frames without opening a window and writes the
+    result to disk. Needs neither OpenGL nor a display.
+*/
+int
+main(int argc, char* argv[])
+{
+    flags::args arguments = flags::args(argc, argv);
+
+    if (arguments.get<bool>("help", false))
+    {
+        PrintUsage();
+        return 0;
+    }
+
+    const int w = arguments.get<int>("width", 500);
+    const int h = arguments.get<int>("height", 300);
+    const int raysPerPixel = arguments.get<int>("rpp", 1);
+    const int maxBounces = arguments.get<int>("bounces", 5);
+    const int rouletteDepth = arguments.get<int>("roulette-depth", 3);
+    const bool sampleLights = arguments.get<bool>("sample-lights", true);
+    const int frames = arguments.get<int>("frames", 16);
+    const float noiseThreshold = arguments.get<float>("noise", 0.0f);
+    const std::string scene = arguments.get<std::string>("scene", "spheres");
+    const std::string saveScene = arguments.get<std::string>("save-scene", "");
+    const std::string samplerName = arguments.get<std::string>("sampler", "sobol");
+    const std::string kernelName = arguments.get<std::string>("kernel", "");
+    const std::string output = arguments.get<std::string>("output", "render.ppm");
+    const float exposure = arguments.get<float>("exposure", 1.0f);
+    const std::string tonemapName = arguments.get<std::string>("tonemap", "clamp");
+    const int statsInterval = arguments.get<int>("stats", 0);
+    const std::string profile = arguments.get<std::string>("profile", "");
+
+    // --frames 0 only converts a scene
+    if (w <= 0 || h <= 0 || raysPerPixel <= 0 || maxBounces < 0 || frames < 0 || (frames == 0 && saveScene.empty()) || statsInterval < 0 || rouletteDepth < 0 || noiseThreshold < 0.0f)
+    {
+        fprintf(stderr, "width, height, rpp and frames must be positive (frames may be 0 with --save-scene), bounces, roulette-depth, stats and noise not negative\n");
+        PrintUsage();
+        return 1;
+    }
+
+    if ((statsInterval > 0 || !profile.empty()) && !Profile::IsEnabled())
+    {
+        fprintf(stderr, "--stats and --profile need a build configured with -DTRAYRACER_PROFILE=ON\n");
+        return 1;
+    }
+    Profile::SetStatsInterval(statsInterval, stdout);
+
+    Tonemap tonemap;
+    if (tonemapName == "clamp")
+        tonemap = TonemapClamp;
+    else if (tonemapName == "reinhard")
+        tonemap = TonemapReinhard;
+    else if (tonemapName == "aces")
+        tonemap = TonemapACES;
+    else
+    {
+        fprintf(stderr, "unknown tonemap '%s'\n", tonemapName.c_str());
+        return 1;
+    }
+
+    ImageFormat format;
+    if (!GetImageFormat(output, format))
+    {
+        fprintf(stderr, "unknown image format '%s'\n", output.c_str());
+        return 1;
+    }
+
+    if (!kernelName.empty() && !SphereStore::SetKernel(kernelName))
+    {
+        fprintf(stderr, "unknown sphere kernel '%s', or this cpu can't run it\n", kernelName.c_str());
+        return 1;
+    }
+
+    Sampler* sampler = CreateSampler(samplerName.c_str());
+    if (sampler == nullptr)
+    {
+        fprintf(stderr, "unknown sampler '%s'\n", samplerName.c_str());
+        return 1;
+    }
+
+    std::vector<Color> framebuffer(w * h);
+    Raytracer rt = Raytracer(w, h, framebuffer, raysPerPixel, maxBounces);
+    rt.SetSampler(sampler);
+    rt.rouletteDepth = rouletteDepth;
+    rt.sampleLights = sampleLights;
+    rt.noiseThreshold = noiseThreshold;
+    rt.exposure = exposure;
+    rt.tonemap = tonemap;
+
+    if (!CreateScene(rt, scene))
+    {
+        fprintf(stderr, "unknown scene '%s'\n", scene.c_str());
+        return 1;
+    }
+
+    if (!saveScene.empty())
+    {
+        if (!SaveScene(rt, saveScene))
+        {
+            fprintf(stderr, "could not write '%s'\n", saveScene.c_str());
+            return 1;
+        }
+        printf("wrote %s\n", saveScene.c_str());
+        if (frames == 0)
+            return 0;
+    }
+
+    // same starting camera as the viewer
+    mat4 cameraTransform = multiply(rotationy(0), rotationx(0));
+    cameraTransform.m30 = 0.0f;
+    cameraTransform.m31 = 1.0f;
+    cameraTransform.m32 = 10.0f;
+    rt.SetViewMatrix(cameraTransform);
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    int frame = 0;
+    while (frame < frames && !rt.IsConverged())
+    {
+        rt.Raytrace();
+        frame++;
+    }
+    auto endTime = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(endTime - startTime).count();
+    // retired tiles get no paths, so count what the pixels actually received
+    const double paths = double(rt.accumulator.GetTotalCount()) * raysPerPixel;
+    printf("%d frames in %.3f s, %.2f Mrays/s\n", frame, seconds, paths / seconds * 1e-6);
+    if (noiseThreshold > 0.0f)
+        printf("%s, %u tiles still active, %.1f frames per pixel on average\n", rt.IsConverged() ? "converged" : "not converged",
+            rt.GetActiveTileCount(), paths / raysPerPixel / (double(w) * h));
+    printf("%.1f%% of paths ended by Russian roulette, %.2f rays per path\n", 100.0 * rt.GetRouletteCount() / paths, rt.GetRayCount() / paths);
+
+    if (!profile.empty())
+    {
+        if (!Profile::WriteChromeTrace(profile))
+        {
+            fprintf(stderr, "could not write '%s'\n", profile.c_str());
+            return 1;
+        }
+        printf("wrote %s\n", profile.c_str());
+    }
+
+    // the framebuffer is already resolved to sRGB, float formats get the linear means
+    bool saved;
+    if (IsHDRFormat(format))
+    {
+        std::vector<Color> means;
+        rt.accumulator.CopyMeans(means);
+        saved = SaveImage(output, format, means, w, h);
+    }
+    else
+    {
+        saved = SaveImage(output, format, framebuffer, w, h);
+    }
+    if (!saved)
+    {
+        fprintf(stderr, "could not write '%s'\n", output.c_str());
+        return 1;
+    }
+    printf("wrote %s\n", output.c_str());
+    return 0;
+}
@@ -0,0 +1,419 @@
+#include "image.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+/**
+*/
+static unsigned char
+ToByte(float value)
+{
+    return (unsigned char)(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Little endian, like every platform we build for
+*/
+template <class T>
+static void
+Append(std::vector<unsigned char>& out, T const& value)
+{
+    const size_t at = out.size();
+    out.resize(at + sizeof(T));
+    memcpy(&out[at], &value, sizeof(T));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+AppendString(std::vector<unsigned char>& out, const char* str)
+{
+    out.insert(out.end(), str, str + strlen(str) + 1);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+AppendBigEndian(std::vector<unsigned char>& out, unsigned value)
+{
+    out.push_back((unsigned char)(value >> 24));
+    out.push_back((unsigned char)(value >> 16));
+    out.push_back((unsigned char)(value >> 8));
+    out.push_back((unsigned char)value);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+EncodePPM(std::vector<unsigned char>& out, std::vector<Color> const& pixels, unsigned width, unsigned height)
+{
+    char header[64];
+    const int length = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", width, height);
+    out.reserve(length + size_t(width) * height * 3);
+    out.insert(out.end(), header, header + length);
+
+    // PPM starts at the top row
+    for (unsigned y = height; y-- > 0;)
+    {
+        Color const* row = &pixels[size_t(y) * width];
+        for (unsigned x = 0; x < width; ++x)
+        {
+            out.push_back(ToByte(row[x].r));
+            out.push_back(ToByte(row[x].g));
+            out.push_back(ToByte(row[x].b));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    PFM rows go bottom to top like ours, a negative scale means little endian
+*/
+static void
+EncodePFM(std::vector<unsigned char>& out, std::vector<Color> const& pixels, unsigned width, unsigned height)
+{
+    char header[64];
+    const int length = snprintf(header, sizeof(header), "PF\n%u %u\n-1.0\n", width, height);
+    const size_t bytes = size_t(width) * height * sizeof(Color);
+    out.reserve(length + bytes);
+    out.insert(out.end(), header, header + length);
+    const unsigned char* data = (const unsigned char*)pixels.data();
+    out.insert(out.end(), data, data + bytes);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static unsigned
+Crc32(const unsigned char* data, size_t size, unsigned crc = 0)
+{
+    static const struct Table
+    {
+        unsigned entries[256];
+        Table()
+        {
+            for (unsigned n = 0; n < 256; ++n)
+            {
+                unsigned c = n;
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                this->entries[n] = c;
+            }
+        }
+    } table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+AppendChunk(std::vector<unsigned char>& out, const char* type, std::vector<unsigned char> const& data)
+{
+    AppendBigEndian(out, (unsigned)data.size());
+    const size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    AppendBigEndian(out, Crc32(&out[start], out.size() - start));
+}
+
+//------------------------------------------------------------------------------
+/**
+    The zlib stream inside IDAT uses stored deflate blocks. That costs size,
+    not time: rendered frames hardly compress with a fast deflate anyway,
+    and encoding becomes a copy.
+*/
+static void
+EncodePNG(std::vector<unsigned char>& out, std::vector<Color> const& pixels, unsigned width, unsigned height)
+{
+    // filter byte 0 (none) in front of every row, top row first
+    const size_t rowSize = size_t(width) * 3 + 1;
+    std::vector<unsigned char> raw(rowSize * height);
+    for (unsigned y = 0; y < height; ++y)
+    {
+        unsigned char* dst = &raw[y * rowSize];
+        Color const* row = &pixels[size_t(height - 1 - y) * width];
+        *dst++ = 0;
+        for (unsigned x = 0; x < width; ++x)
+        {
+            *dst++ = ToByte(row[x].r);
+            *dst++ = ToByte(row[x].g);
+            *dst++ = ToByte(row[x].b);
+        }
+    }
+
+    std::vector<unsigned char> zlib;
+    zlib.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    size_t at = 0;
+    do
+    {
+        const unsigned short length = (unsigned short)std::min<size_t>(raw.size() - at, 65535);
+        const bool last = at + length == raw.size();
+        zlib.push_back(last ? 1 : 0);
+        Append(zlib, length);
+        Append(zlib, (unsigned short)~length);
+        zlib.insert(zlib.end(), raw.begin() + at, raw.begin() + at + length);
+        at += length;
+    } while (at < raw.size());
+
+    // adler32 of the uncompressed data, 5552 is the most bytes before the sums can overflow
+    unsigned a = 1, b = 0;
+    for (size_t i = 0; i < raw.size();)
+    {
+        const size_t end = std::min(raw.size(), i + 5552);
+        for (; i < end; ++i)
+        {
+            a += raw[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    AppendBigEndian(zlib, (b << 16) | a);
+
+    std::vector<unsigned char> header;
+    AppendBigEndian(header, width);
+    AppendBigEndian(header, height);
+    // 8 bit RGB, deflate, adaptive filtering, not interlaced
+    const unsigned char format[5] = { 8, 2, 0, 0, 0 };
+    header.insert(header.end(), format, format + 5);
+
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    out.insert(out.end(), signature, signature + 8);
+    AppendChunk(out, "IHDR", header);
+    AppendChunk(out, "IDAT", zlib);
+    AppendChunk(out, "IEND", std::vector<unsigned char>());
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+AppendAttribute(std::vector<unsigned char>& out, const char* name, const char* type, const void* value, int size)
+{
+    AppendString(out, name);
+    AppendString(out, type);
+    Append(out, size);
+    out.insert(out.end(), (const unsigned char*)value, (const unsigned char*)value + size);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Single part scanline file with the attributes every reader requires,
+    one uncompressed scanline per block and 32 bit float channels.
+*/
+static void
+EncodeEXR(std::vector<unsigned char>& out, std::vector<Color> const& pixels, unsigned width, unsigned height)
+{
+    const size_t lineSize = size_t(width) * 3 * sizeof(float);
+    out.reserve(512 + height * (8 + 8 + lineSize));
+
+    // magic number and version 2, single part scanline
+    const unsigned char magic[4] = { 0x76, 0x2f, 0x31, 0x01 };
+    out.insert(out.end(), magic, magic + 4);
+    Append(out, 2);
+
+    // channels are sorted by name
+    std::vector<unsigned char> channels;
+    for (const char* name : { "B", "G", "R" })
+    {
+        AppendString(channels, name);
+        // pixel type FLOAT, not linear, reserved, x and y sampling
+        Append(channels, 2);
+        const unsigned char linearAndReserved[4] = { 0, 0, 0, 0 };
+        channels.insert(channels.end(), linearAndReserved, linearAndReserved + 4);
+        Append(channels, 1);
+        Append(channels, 1);
+    }
+    channels.push_back(0);
+    AppendAttribute(out, "channels", "chlist", channels.data(), (int)channels.size());
+
+    const unsigned char compression = 0;
+    AppendAttribute(out, "compression", "compression", &compression, 1);
+    const int window[4] = { 0, 0, int(width) - 1, int(height) - 1 };
+    AppendAttribute(out, "dataWindow", "box2i", window, sizeof(window));
+    AppendAttribute(out, "displayWindow", "box2i", window, sizeof(window));
+    const unsigned char lineOrder = 0;
+    AppendAttribute(out, "lineOrder", "lineOrder", &lineOrder, 1);
+    const float aspect = 1.0f;
+    AppendAttribute(out, "pixelAspectRatio", "float", &aspect, sizeof(aspect));
+    const float center[2] = { 0.0f, 0.0f };
+    AppendAttribute(out, "screenWindowCenter", "v2f", center, sizeof(center));
+    const float windowWidth = 1.0f;
+    AppendAttribute(out, "screenWindowWidth", "float", &windowWidth, sizeof(windowWidth));
+    out.push_back(0);
+
+    // offset table, then the scanlines top to bottom
+    unsigned long long offset = out.size() + size_t(height) * sizeof(unsigned long long);
+    for (unsigned y = 0; y < height; ++y)
+    {
+        Append(out, offset);
+        offset += 8 + lineSize;
+    }
+    for (unsigned y = 0; y < height; ++y)
+    {
+        Append(out, int(y));
+        Append(out, int(lineSize));
+        Color const* row = &pixels[size_t(height - 1 - y) * width];
+        for (unsigned x = 0; x < width; ++x) Append(out, row[x].b);
+        for (unsigned x = 0; x < width; ++x) Append(out, row[x].g);
+        for (unsigned x = 0; x < width; ++x) Append(out, row[x].r);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+GetImageFormat(std::string const& path, ImageFormat& format)
+{
+    const size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos)
+        return false;
+
+    std::string extension = path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+    if (extension == "ppm")
+        format = ImagePPM;
+    else if (extension == "png")
+        format = ImagePNG;
+    else if (extension == "pfm")
+        format = ImagePFM;
+    else if (extension == "exr")
+        format = ImageEXR;
+    else
+        return false;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+IsHDRFormat(ImageFormat format)
+{
+    return format == ImagePFM || format == ImageEXR;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+SaveImage(std::string const& path, ImageFormat format, std::vector<Color> const& pixels, unsigned width, unsigned height)
+{
+    if (pixels.size() < size_t(width) * height)
+        return false;
+
+    std::vector<unsigned char> encoded;
+    switch (format)
+    {
+    case ImagePPM:
+        EncodePPM(encoded, pixels, width, height);
+        break;
+    case ImagePNG:
+        EncodePNG(encoded, pixels, width, height);
+        break;
+    case ImagePFM:
+        EncodePFM(encoded, pixels, width, height);
+        break;
+    case ImageEXR:
+        EncodeEXR(encoded, pixels, width, height);
+        break;
+    }
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    const bool written = fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+    return fclose(file) == 0 && written;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+ImageWriter::ImageWriter() :
+    thread(&ImageWriter::Work, this)
+{
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+ImageWriter::~ImageWriter()
+{
+    this->Wait();
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->quit = true;
+    }
+    this->wake.notify_all();
+    this->thread.join();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ImageWriter::Save(std::string const& path, ImageFormat format, std::vector<Color> pixels, unsigned width, unsigned height)
+{
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->jobs.push_back({ path, format, std::move(pixels), width, height });
+    }
+    this->wake.notify_all();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+ImageWriter::Wait()
+{
+    std::unique_lock<std::mutex> guard(this->mutex);
+    this->done.wait(guard, [this]() { return this->jobs.empty() && !this->writing; });
+    const bool ok = !this->failed;
+    this->failed = false;
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ImageWriter::Work()
+{
+    std::unique_lock<std::mutex> guard(this->mutex);
+    while (true)
+    {
+        this->wake.wait(guard, [this]() { return this->quit || !this->jobs.empty(); });
+        if (this->jobs.empty())
+            return;
+
+        Job job = std::move(this->jobs.front());
+        this->jobs.pop_front();
+        this->writing = true;
+        guard.unlock();
+
+        const bool ok = SaveImage(job.path, job.format, job.pixels, job.width, job.height);
+        if (!ok)
+            fprintf(stderr, "could not write image '%s'\n", job.path.c_str());
+
+        guard.lock();
+        this->writing = false;
+        this->failed |= !ok;
+        if (this->jobs.empty())
+            this->done.notify_all();
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "color.h"
+
+//------------------------------------------------------------------------------
+/**
+    File formats SaveImage can write
+*/
+enum ImageFormat
+{
+    // 8 bit binary PPM
+    ImagePPM,
+    // 8 bit PNG, stored without compression
+    ImagePNG,
+    // 32 bit float portable float map
+    ImagePFM,
+    // 32 bit float OpenEXR, uncompressed scanlines
+    ImageEXR
+};
+
+/// Pick the format from the extension of path (.ppm, .png, .pfm or .exr).
+/// Returns false if the extension is none of those.
+bool GetImageFormat(std::string const& path, ImageFormat& format);
+
+/// True for the float formats. They want linear pixels, not display ready ones.
+bool IsHDRFormat(ImageFormat format);
+
+/// Write width x height pixels, stored bottom row first the way the raytracer
+/// fills its framebuffer. 8 bit formats clamp to 0..1 and expect display
+/// ready values, float formats store the pixels as they are. The file is
+/// encoded in memory and written in one go. Returns false on failure.
+bool SaveImage(std::string const& path, ImageFormat format, std::vector<Color> const& pixels, unsigned width, unsigned height);
+
+//------------------------------------------------------------------------------
+/**
+    Encodes and writes images on a thread of its own, so that saving never
+    holds up rendering. Images are written in the order they were queued.
+*/
+class ImageWriter
+{
+public:
+    ImageWriter();
+    // writes everything still queued before returning
+    ~ImageWriter();
+
+    // queue an image, pixels are moved in so pass a copy of anything still in use
+    void Save(std::string const& path, ImageFormat format, std::vector<Color> pixels, unsigned width, unsigned height);
+
+    // block until the queue is empty. Returns false if any image failed since the last Wait
+    bool Wait();
+
+private:
+    struct Job
+    {
+        std::string path;
+        ImageFormat format;
+        std::vector<Color> pixels;
+        unsigned width;
+        unsigned height;
+    };
+
+    // writer thread main loop
+    void Work();
+
+    std::mutex mutex;
+    // signalled when a job is queued, or when the writer shuts down
+    std::condition_variable wake;
+    // signalled when the queue runs empty
+    std::condition_variable done;
+    std::deque<Job> jobs;
+    // true while the writer thread works on a job it took off the queue
+    bool writing = false;
+    bool failed = false;
+    bool quit = false;
+    // started last, once everything it uses exists
+    std::thread thread;
+};
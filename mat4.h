@@ -1,15 +1,26 @@
 #pragma once
 #include "vec3.h"
 
+// rows of a float matrix are exactly one 4 wide register
+#if !defined(TRAYRACER_DOUBLE_PRECISION)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MAT4_SSE 1
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#define MAT4_NEON 1
+#include <arm_neon.h>
+#endif
+#endif
+
 //------------------------------------------------------------------------------
 /**
     @struct mat4
 
-    4x4 matrix
+    4x4 matrix, row major
 */
-struct mat4
+struct alignas(16) mat4
 {
-    float 
+    scalar 
     m00, m01, m02, m03,
     m10, m11, m12, m13,
     m20, m21, m22, m23,
@@ -57,12 +68,26 @@ get_position(mat4 m)
     transform vector with matrix basis
 */
 inline vec3
-transform(vec3 v, mat4 m)
+transform(vec3 v, mat4 const& m)
 {
+#if MAT4_SSE
+    __m128 r = _mm_mul_ps(_mm_load_ps(&m.m00), _mm_set1_ps(v.x));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(&m.m10), _mm_set1_ps(v.y)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(&m.m20), _mm_set1_ps(v.z)));
+    alignas(16) float out[4];
+    _mm_store_ps(out, r);
+    return { out[0], out[1], out[2] };
+#elif MAT4_NEON
+    float32x4_t r = vmulq_n_f32(vld1q_f32(&m.m00), v.x);
+    r = vmlaq_n_f32(r, vld1q_f32(&m.m10), v.y);
+    r = vmlaq_n_f32(r, vld1q_f32(&m.m20), v.z);
+    return { vgetq_lane_f32(r, 0), vgetq_lane_f32(r, 1), vgetq_lane_f32(r, 2) };
+#else
     vec3 x = vec3{ m.m00, m.m01, m.m02 } * v.x;
     vec3 y = vec3{ m.m10, m.m11, m.m12 } * v.y;
     vec3 z = vec3{ m.m20, m.m21, m.m22 } * v.z;
     return (x + y + z);
+#endif
 
     ////swizzle!
     ////this should be easy to vectorize! ;)
@@ -109,8 +134,8 @@ TBN(vec3 normal)
     }
     else
     {
-        float a = 1.0f / (1.0f + normal.z);
-        float b = -normal.x * normal.y * a;
+        scalar a = 1.0f / (1.0f + normal.z);
+        scalar b = -normal.x * normal.y * a;
 
         ret.m00 = 1.0f - normal.x * normal.x * a;
         ret.m01 = b;
@@ -134,7 +159,7 @@ TBN(vec3 normal)
 /**
     Calculate determinant
 */
-inline float
+inline scalar
 det(mat4 m)
 {
     return 
@@ -153,7 +178,7 @@ det(mat4 m)
 inline mat4
 inverse(mat4 m)
 {
-    float s = det(m);
+    scalar s = det(m);
     
     if (s == 0.0) 
 		return {1,0,0,0,0,1,0,0,0,0,1,0,0,0,0,1}; // cannot inverse, make it identity matrix
@@ -197,8 +222,44 @@ transpose(mat4 m)
 /**
 */
 inline mat4
-multiply(mat4 b, mat4 a)
+multiply(mat4 const& b, mat4 const& a)
 {
+#if MAT4_SSE
+    // every row of the result is a combination of the rows of b, weighted by the same row of a
+    const __m128 b0 = _mm_load_ps(&b.m00);
+    const __m128 b1 = _mm_load_ps(&b.m10);
+    const __m128 b2 = _mm_load_ps(&b.m20);
+    const __m128 b3 = _mm_load_ps(&b.m30);
+    mat4 ret;
+    scalar const* in = &a.m00;
+    scalar* out = &ret.m00;
+    for (int row = 0; row < 4; ++row)
+    {
+        __m128 r = _mm_mul_ps(b0, _mm_set1_ps(in[row * 4 + 0]));
+        r = _mm_add_ps(r, _mm_mul_ps(b1, _mm_set1_ps(in[row * 4 + 1])));
+        r = _mm_add_ps(r, _mm_mul_ps(b2, _mm_set1_ps(in[row * 4 + 2])));
+        r = _mm_add_ps(r, _mm_mul_ps(b3, _mm_set1_ps(in[row * 4 + 3])));
+        _mm_store_ps(out + row * 4, r);
+    }
+    return ret;
+#elif MAT4_NEON
+    const float32x4_t b0 = vld1q_f32(&b.m00);
+    const float32x4_t b1 = vld1q_f32(&b.m10);
+    const float32x4_t b2 = vld1q_f32(&b.m20);
+    const float32x4_t b3 = vld1q_f32(&b.m30);
+    mat4 ret;
+    scalar const* in = &a.m00;
+    scalar* out = &ret.m00;
+    for (int row = 0; row < 4; ++row)
+    {
+        float32x4_t r = vmulq_n_f32(b0, in[row * 4 + 0]);
+        r = vmlaq_n_f32(r, b1, in[row * 4 + 1]);
+        r = vmlaq_n_f32(r, b2, in[row * 4 + 2]);
+        r = vmlaq_n_f32(r, b3, in[row * 4 + 3]);
+        vst1q_f32(out + row * 4, r);
+    }
+    return ret;
+#else
     return { b.m00*a.m00 + b.m10*a.m01 + b.m20*a.m02 + b.m30*a.m03,
              b.m01*a.m00 + b.m11*a.m01 + b.m21*a.m02 + b.m31*a.m03,
              b.m02*a.m00 + b.m12*a.m01 + b.m22*a.m02 + b.m32*a.m03,
@@ -218,17 +279,18 @@ multiply(mat4 b, mat4 a)
              b.m01*a.m30 + b.m11*a.m31 + b.m21*a.m32 + b.m31*a.m33,
              b.m02*a.m30 + b.m12*a.m31 + b.m22*a.m32 + b.m32*a.m33,
              b.m03*a.m30 + b.m13*a.m31 + b.m23*a.m32 + b.m33*a.m33 };
+#endif
 }
 
 //------------------------------------------------------------------------------
 /**
 */
 inline mat4
-rotationx(float angle)
+rotationx(scalar angle)
 {
-    float result;
-	float c;
-	float s;
+    scalar result;
+	scalar c;
+	scalar s;
 
 	if (angle == 180.0f){
 		result = MPI;
@@ -251,11 +313,11 @@ rotationx(float angle)
 /**
 */
 inline mat4
-rotationy(float angle)
+rotationy(scalar angle)
 {
-    float result;
-	float c;
-	float s;
+    scalar result;
+	scalar c;
+	scalar s;
 
 	if (angle == 180.0f){
 		result = MPI;
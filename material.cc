@@ -3,40 +3,57 @@
 #include <time.h>
 #include "mat4.h"
 #include "sphere.h"
-#include "random.h"
+
+//------------------------------------------------------------------------------
+/**
+*/
+float
+GetSpecularProbability(Material const* const material, Ray const& ray, vec3 normal)
+{
+    if (material->type == Dielectric)
+        return 1.0f;
+
+    float F0 = 0.04f;
+    if (material->type == Conductor)
+    {
+        F0 = 0.95f;
+    }
+    float cosTheta = -dot(normalize(ray.m), normalize(normal));
+    return FresnelSchlick(cosTheta, F0, material->roughness);
+}
 
 //------------------------------------------------------------------------------
 /**
 */
 Ray
-BSDF(Material const* const material, Ray ray, vec3 point, vec3 normal)
+BSDF(Material const* const material, Ray const& ray, vec3 point, vec3 normal, SampleStream& samples, float& diffusePdf)
 {
     float cosTheta = -dot(normalize(ray.m), normalize(normal));
+    diffusePdf = 0.0f;
 
     if (material->type != Dielectric)
     {
-        float F0 = 0.04f;
-        if (material->type == Conductor)
-        {
-            F0 = 0.95f;
-        }
-
         // probability that a ray will reflect on a microfacet
-        float F = FresnelSchlick(cosTheta, F0, material->roughness);
+        float F = GetSpecularProbability(material, ray, normal);
 
-        float r = RandomFloat();
+        float r = NextSample(samples);
 
         if (r < F)
         {
             mat4 basis = TBN(normal);
             // importance sample with brdf specular lobe
-            vec3 H = ImportanceSampleGGX_VNDF(RandomFloat(), RandomFloat(), material->roughness, ray.m, basis);
+            vec3 H = ImportanceSampleGGX_VNDF(NextSample(samples), NextSample(samples), material->roughness, ray.m, basis);
             vec3 reflected = reflect(ray.m, H);
             return { point, normalize(reflected) };
         }
         else
         {
-            return { point, normalize(normalize(normal) + random_point_on_unit_sphere()) };
+            // normal plus a uniform point on the sphere is cosine distributed
+            float u = NextSample(samples);
+            float v = NextSample(samples);
+            vec3 direction = normalize(normalize(normal) + random_point_on_unit_sphere(u, v));
+            diffusePdf = (1.0f - F) * fmaxf((float)dot(direction, normalize(normal)), 0.0f) / (float)MPI;
+            return { point, direction };
         }
     }
     else
@@ -57,7 +74,7 @@ BSDF(Material const* const material, Ray ray, vec3 point, vec3 normal)
         else
         {
             outwardNormal = normal;
-            niOverNt = 1.0 / material->refractionIndex;
+            niOverNt = 1.0f / material->refractionIndex;
             cosine = cosTheta / len(rayDir);
         }
 
@@ -69,9 +86,9 @@ BSDF(Material const* const material, Ray ray, vec3 point, vec3 normal)
         }
         else
         {
-            reflect_prob = 1.0;
+            reflect_prob = 1.0f;
         }
-        if (RandomFloat() < reflect_prob)
+        if (NextSample(samples) < reflect_prob)
         {
             vec3 reflected = reflect(rayDir, normal);
             return { point, reflected };
@@ -81,4 +98,43 @@ BSDF(Material const* const material, Ray ray, vec3 point, vec3 normal)
             return { point, refracted };
         }
     }
-}
\ No newline at end of file
+}
+//------------------------------------------------------------------------------
+/**
+*/
+unsigned
+MaterialStore::Add(Material const& material)
+{
+    if (this->view)
+    {
+        this->owned.assign(this->materials, this->materials + this->count);
+        this->view = false;
+    }
+    this->owned.push_back(material);
+    this->materials = this->owned.data();
+    return this->count++;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+MaterialStore::SetView(Material const* materials, unsigned count)
+{
+    this->Clear();
+    this->materials = materials;
+    this->count = count;
+    this->view = true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+MaterialStore::Clear()
+{
+    this->owned.clear();
+    this->materials = nullptr;
+    this->count = 0;
+    this->view = false;
+}
@@ -2,6 +2,7 @@
 #include "color.h"
 #include "ray.h"
 #include "vec3.h"
+#include "sampler.h"
 #include <vector>
 #include <string>
 
@@ -12,13 +13,16 @@ enum MaterialType
 {
     Lambertian,
     Dielectric,
-    Conductor
+    Conductor,
+    // a light, color is the radiance it emits and may exceed 1. Emissive
+    // surfaces end paths instead of scattering them
+    Emissive
 };
 struct Material
 {
     
     /*
-        type can be "Lambertian", "Dielectric" or "Conductor".
+        type can be "Lambertian", "Dielectric", "Conductor" or "Emissive".
         Obviously, "lambertian" materials are dielectric, but we separate them here
         just because figuring out a good IOR for ex. plastics is too much work
     */
@@ -33,6 +37,61 @@ struct Material
 
 //------------------------------------------------------------------------------
 /**
-    Scatter ray against material
+    Scatter ray against material, drawing the next dimensions of samples.
+    diffusePdf is set to the solid angle pdf of the new direction if it was
+    drawn from the diffuse lobe, and to 0 if it came from any other lobe
 */
-Ray BSDF(Material const* const material, Ray ray, vec3 point, vec3 normal);
+Ray BSDF(Material const* const material, Ray const& ray, vec3 point, vec3 normal, SampleStream& samples, float& diffusePdf);
+
+//------------------------------------------------------------------------------
+/**
+    Probability that BSDF picks a lobe other than the diffuse one for a ray
+    arriving at normal. The diffuse lobe is weighted by the rest of it
+*/
+float GetSpecularProbability(Material const* const material, Ray const& ray, vec3 normal);
+
+//------------------------------------------------------------------------------
+/**
+    Every material of a scene, stored next to each other and referenced by
+    index. Like SphereStore the materials are either owned or a read only view
+    of someone else's memory, which is copied out the first time it changes.
+*/
+class MaterialStore
+{
+public:
+    MaterialStore() = default;
+    // materials may point into the store itself
+    MaterialStore(MaterialStore const&) = delete;
+    MaterialStore& operator=(MaterialStore const&) = delete;
+
+    // add a material, returns its index
+    unsigned Add(Material const& material);
+
+    // use count materials from external memory, which must outlive the view
+    void SetView(Material const* materials, unsigned count);
+
+    // remove all materials
+    void Clear();
+
+    // number of materials
+    unsigned Size() const;
+
+    Material const& operator[](unsigned index) const;
+
+    // all materials, Size() of them
+    Material const* materials = nullptr;
+
+private:
+    std::vector<Material> owned;
+    unsigned count = 0;
+    bool view = false;
+};
+
+inline unsigned MaterialStore::Size() const
+{
+    return this->count;
+}
+inline Material const& MaterialStore::operator[](unsigned index) const
+{
+    return this->materials[index];
+}
@@ -0,0 +1,233 @@
+#include "mesh.h"
+#include <math.h>
+#include "profile.h"
+
+// hits closer than this are ignored, same as for spheres
+static constexpr float MinDist = 0.001f;
+
+//------------------------------------------------------------------------------
+/**
+    The ray transformed so that it points down +z, set up once per ray and
+    mesh. See Woop, Benthin and Wald, "Watertight Ray/Triangle Intersection".
+*/
+struct WatertightRay
+{
+    float origin[3];
+    // axis the ray is most aligned with, and the two others
+    int kx, ky, kz;
+    // shear that lines the ray up with z
+    float sx, sy, sz;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+static WatertightRay
+SetupRay(Ray const& ray)
+{
+    WatertightRay r;
+    r.origin[0] = (float)ray.b.x;
+    r.origin[1] = (float)ray.b.y;
+    r.origin[2] = (float)ray.b.z;
+    const float dir[3] = { (float)ray.m.x, (float)ray.m.y, (float)ray.m.z };
+
+    r.kz = 0;
+    if (fabsf(dir[1]) > fabsf(dir[r.kz]))
+        r.kz = 1;
+    if (fabsf(dir[2]) > fabsf(dir[r.kz]))
+        r.kz = 2;
+    r.kx = (r.kz + 1) % 3;
+    r.ky = (r.kx + 1) % 3;
+    // keep the winding of the triangles as it is
+    if (dir[r.kz] < 0.0f)
+        std::swap(r.kx, r.ky);
+
+    r.sx = dir[r.kx] / dir[r.kz];
+    r.sy = dir[r.ky] / dir[r.kz];
+    r.sz = 1.0f / dir[r.kz];
+    return r;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Edges are evaluated the same way for both triangles sharing them, and
+    redone in double when they come out exactly zero, so a ray never slips
+    through the crack between two triangles.
+*/
+static inline bool
+IntersectTriangle(WatertightRay const& r, float const* p0, float const* p1, float const* p2, float tMax, float& t)
+{
+    const float a[3] = { p0[0] - r.origin[0], p0[1] - r.origin[1], p0[2] - r.origin[2] };
+    const float b[3] = { p1[0] - r.origin[0], p1[1] - r.origin[1], p1[2] - r.origin[2] };
+    const float c[3] = { p2[0] - r.origin[0], p2[1] - r.origin[1], p2[2] - r.origin[2] };
+
+    const float ax = a[r.kx] - r.sx * a[r.kz];
+    const float ay = a[r.ky] - r.sy * a[r.kz];
+    const float bx = b[r.kx] - r.sx * b[r.kz];
+    const float by = b[r.ky] - r.sy * b[r.kz];
+    const float cx = c[r.kx] - r.sx * c[r.kz];
+    const float cy = c[r.ky] - r.sy * c[r.kz];
+
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+    if (u == 0.0f || v == 0.0f || w == 0.0f)
+    {
+        u = (float)((double)cx * (double)by - (double)cy * (double)bx);
+        v = (float)((double)ax * (double)cy - (double)ay * (double)cx);
+        w = (float)((double)bx * (double)ay - (double)by * (double)ax);
+    }
+
+    // the ray has to be on the same side of all three edges
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+        return false;
+    const float det = u + v + w;
+    if (det == 0.0f)
+        return false;
+
+    const float az = r.sz * a[r.kz];
+    const float bz = r.sz * b[r.kz];
+    const float cz = r.sz * c[r.kz];
+    t = (u * az + v * bz + w * cz) / det;
+    return t > MinDist && t < tMax;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Mesh::Mesh(std::vector<float> positions, std::vector<unsigned> indices) :
+    positions(std::move(positions)),
+    indices(std::move(indices))
+{
+    const unsigned count = this->GetTriangleCount();
+    std::vector<AABB> bounds(count);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        grow(bounds[i], this->GetVertex(this->indices[i * 3]));
+        grow(bounds[i], this->GetVertex(this->indices[i * 3 + 1]));
+        grow(bounds[i], this->GetVertex(this->indices[i * 3 + 2]));
+    }
+    this->bvh.Build(bounds);
+
+    // sort the triangles into leaf order, so a leaf reads one contiguous range
+    std::vector<unsigned> sorted(this->indices.size());
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const unsigned triangle = this->bvh.indices[i];
+        sorted[i * 3] = this->indices[triangle * 3];
+        sorted[i * 3 + 1] = this->indices[triangle * 3 + 1];
+        sorted[i * 3 + 2] = this->indices[triangle * 3 + 2];
+        this->bvh.indices[i] = i;
+    }
+    this->indices.swap(sorted);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+Mesh::Intersect(Ray const& ray, float& tMax, unsigned& hitTriangle) const
+{
+    const WatertightRay r = SetupRay(ray);
+    return this->bvh.Intersect(ray, tMax, [this, &r, &hitTriangle](unsigned first, unsigned count, float& tMax)
+    {
+        PROFILE_COUNT(CounterTriangleTests, count);
+        bool isHit = false;
+        for (unsigned i = first; i < first + count; ++i)
+        {
+            unsigned const* triangle = &this->indices[i * 3];
+            float t;
+            if (IntersectTriangle(r, &this->positions[triangle[0] * 3], &this->positions[triangle[1] * 3], &this->positions[triangle[2] * 3], tMax, t))
+            {
+                tMax = t;
+                hitTriangle = i;
+                isHit = true;
+            }
+        }
+        return isHit;
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+vec3
+Mesh::GetNormal(unsigned triangle) const
+{
+    const vec3 p0 = this->GetVertex(this->indices[triangle * 3]);
+    const vec3 p1 = this->GetVertex(this->indices[triangle * 3 + 1]);
+    const vec3 p2 = this->GetVertex(this->indices[triangle * 3 + 2]);
+    return cross(p1 - p0, p2 - p0);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+AABB
+Mesh::GetBounds() const
+{
+    if (this->bvh.IsEmpty())
+        return AABB();
+
+    BVHNode const& root = this->bvh.nodes[0];
+    AABB box;
+    box.min = vec3(root.min[0], root.min[1], root.min[2]);
+    box.max = vec3(root.max[0], root.max[1], root.max[2]);
+    return box;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The world bounds are those of the transformed corners of the mesh bounds,
+    computed once since neither the mesh nor the transform change.
+*/
+MeshInstance::MeshInstance(Mesh const* mesh, mat4 const& transform, unsigned material) :
+    mesh(mesh),
+    transform(transform),
+    invTransform(inverse(transform)),
+    material(material)
+{
+    const AABB local = mesh->GetBounds();
+    if (local.min.x > local.max.x)
+        return;
+
+    for (unsigned corner = 0; corner < 8; ++corner)
+    {
+        const vec3 p = vec3(corner & 1 ? local.max.x : local.min.x, corner & 2 ? local.max.y : local.min.y, corner & 4 ? local.max.z : local.min.z);
+        grow(this->bounds, ::transform(p, this->transform) + get_position(this->transform));
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    The ray is moved into object space without normalizing its direction, so
+    distances along it are the same in both spaces.
+*/
+bool
+MeshInstance::Intersect(Ray const& ray, float maxDist, HitResult& hit)
+{
+    const Ray local(::transform(ray.b, this->invTransform) + get_position(this->invTransform), ::transform(ray.m, this->invTransform));
+
+    float t = maxDist;
+    unsigned triangle;
+    if (!this->mesh->Intersect(local, t, triangle))
+        return false;
+
+    // normals go by the inverse transpose
+    const vec3 n = this->mesh->GetNormal(triangle);
+    hit.normal = normalize(vec3(dot(n, get_row0(this->invTransform)), dot(n, get_row1(this->invTransform)), dot(n, get_row2(this->invTransform))));
+    hit.p = ray.PointAt(t);
+    hit.t = t;
+    hit.object = this;
+    hit.material = this->material;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+AABB
+MeshInstance::GetBounds()
+{
+    return this->bounds;
+}
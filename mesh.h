@@ -0,0 +1,79 @@
+#pragma once
+#include <vector>
+#include "object.h"
+#include "bvh.h"
+#include "mat4.h"
+
+//------------------------------------------------------------------------------
+/**
+    Indexed triangle mesh in object space, with a BVH over its triangles.
+
+    A mesh is geometry only, it never shows up in the scene by itself.
+    MeshInstance places it with a transform, so the same mesh can be used any
+    number of times while its vertices and BVH are stored once.
+
+    Triangles are wound counter clockwise seen from outside; the winding only
+    decides which way the normal points, both sides are hit.
+*/
+class Mesh
+{
+public:
+    // three floats per vertex, three vertex indices per triangle. Builds the
+    // BVH right away and sorts the triangles into its leaf order
+    Mesh(std::vector<float> positions, std::vector<unsigned> indices);
+
+    // find the closest triangle the object space ray hits nearer than tMax.
+    // Returns true and shrinks tMax on a hit, with the triangle in hitTriangle
+    bool Intersect(Ray const& ray, float& tMax, unsigned& hitTriangle) const;
+
+    // unnormalized geometric normal of a triangle, in object space
+    vec3 GetNormal(unsigned triangle) const;
+
+    // object space bounds of the whole mesh
+    AABB GetBounds() const;
+
+    unsigned GetTriangleCount() const;
+
+    std::vector<float> positions;
+    std::vector<unsigned> indices;
+    BVH bvh;
+
+private:
+    vec3 GetVertex(unsigned index) const;
+};
+
+//------------------------------------------------------------------------------
+/**
+    A mesh placed in the scene with an object to world transform. Instances
+    are what the scene BVH is built over, which makes it the top level of a
+    two level hierarchy with a BVH per mesh below it.
+*/
+class MeshInstance : public Object
+{
+public:
+    // mesh must outlive the instance
+    MeshInstance(Mesh const* mesh, mat4 const& transform, unsigned material);
+
+    bool Intersect(Ray const& ray, float maxDist, HitResult& hit) override;
+    AABB GetBounds() override;
+
+    Mesh const* const mesh;
+    // object to world, row vectors like everywhere else
+    const mat4 transform;
+    const mat4 invTransform;
+    // index returned from Raytracer::AddMaterial
+    const unsigned material;
+
+private:
+    AABB bounds;
+};
+
+inline unsigned Mesh::GetTriangleCount() const
+{
+    return (unsigned)this->indices.size() / 3;
+}
+inline vec3 Mesh::GetVertex(unsigned index) const
+{
+    float const* p = &this->positions[index * 3];
+    return vec3(p[0], p[1], p[2]);
+}
@@ -1,60 +1,35 @@
 #pragma once
 #include "ray.h"
 #include "color.h"
+#include "aabb.h"
+#include "sampler.h"
 #include <float.h>
 #include <string>
-#include <memory>
 
 class Object;
+struct Material;
 
 //------------------------------------------------------------------------------
 /**
 */
 struct HitResult
 {
+    static constexpr unsigned NoSphere = ~0u;
+
     // hit point
     vec3 p;
     // normal
     vec3 normal;
-    // hit object, or nullptr
+    // hit object, or nullptr for packed spheres (see SphereStore)
     Object* object = nullptr;
+    // index of the material of the hit in the scene's materials
+    unsigned material = 0;
+    // index of the hit packed sphere, or NoSphere for objects
+    unsigned sphere = NoSphere;
     // intersection distance
     float t = FLT_MAX;
 };
 
-template<class TYPE>
-class Optional
-{
-public:
-    Optional() {}
-    Optional(HitResult hit) : hasValue(true)
-    {
-        this->value = std::make_shared<HitResult>(hit);
-    }
-
-    bool HasValue()
-    {
-        // check if this object has a value.
-        if (this->hasValue)
-        {
-            return true;
-        }
-        else
-        {
-            return false;
-        }
-    }
-    HitResult Get()
-    {
-        assert(this->HasValue());
-        return *value;
-    }
-
-private:
-    bool hasValue = false;
-    std::shared_ptr<HitResult> value = nullptr;
-};
-
 //------------------------------------------------------------------------------
 /**
 */
@@ -85,9 +60,11 @@ public:
         //delete[] name;
     }
 
-    virtual Optional<HitResult> Intersect(Ray ray, float maxDist) { return {}; };
-    virtual Color GetColor() = 0;
-    virtual Ray ScatterRay(Ray ray, vec3 point, vec3 normal) { return Ray({ 0,0,0 }, {1,1,1}); };
+    // find the closest intersection nearer than maxDist. Fills in hit, including
+    // its material, and returns true if there is one
+    virtual bool Intersect(Ray const& ray, float maxDist, HitResult& hit) { return false; };
+    // world space bounds, used to place the object in the scene BVH
+    virtual AABB GetBounds() { return { { -FLT_MAX, -FLT_MAX, -FLT_MAX }, { FLT_MAX, FLT_MAX, FLT_MAX } }; };
     //std::string GetName() { return std::string((const char*)name); }
     unsigned long long GetId() { return this->id; }
 
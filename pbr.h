@@ -9,7 +9,7 @@
 inline float
 FresnelSchlick(float cosTheta, float F0, float roughness)
 {
-    return F0 + (fmax(1.0f - roughness, F0) - F0) * pow(2, ((-5.55473f*cosTheta - 6.98316f) * cosTheta));
+    return F0 + (fmaxf(1.0f - roughness, F0) - F0) * exp2f((-5.55473f*cosTheta - 6.98316f) * cosTheta);
 }
 
 //------------------------------------------------------------------------------
@@ -29,13 +29,13 @@ ImportanceSampleGGX_VNDF(float u1, float u2, float roughness, vec3 const& V, mat
     vec3 T1 = lensq > 0.0f ? vec3(-Vh.y, Vh.x, 0.0f) * (1 / sqrtf(lensq)) : vec3(1.0f, 0.0f, 0.0f);
     vec3 T2 = cross(Vh, T1);
 
-    float r = sqrt(u1);
-    float phi = 2.0f * MPI * u2;
-    float t1 = r * cos(phi);
-    float t2 = r * sin(phi);
-    float s = 0.5 * (1.0 + Vh.z);
+    float r = sqrtf(u1);
+    float phi = 2.0f * (float)MPI * u2;
+    float t1 = r * cosf(phi);
+    float t2 = r * sinf(phi);
+    float s = 0.5f * (1.0f + Vh.z);
     float t1sq = (t1 * t1);
-    t2 = (1.0 - s) * sqrtf(1.0 - t1sq) + s * t2;
+    t2 = (1.0f - s) * sqrtf(1.0f - t1sq) + s * t2;
 
     vec3 Nh = T1 * t1 + T2 * t2 + Vh * sqrtf(fmaxf(0.0f, 1.0f - t1sq - (t2 * t2)));
 
@@ -57,7 +57,7 @@ Refract(vec3 v, vec3 n, float niOverNt, vec3& refracted)
     float discriminant = 1.0f - niOverNt * niOverNt * (1.0f - dt * dt);
     if (discriminant > 0)
     {
-        refracted = ((uv - n * dt) * niOverNt) - (n * sqrt(discriminant));
+        refracted = ((uv - n * dt) * niOverNt) - (n * sqrtf(discriminant));
         return true;
     }
 
@@ -0,0 +1,313 @@
+#include "profile.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace Profile
+{
+
+static const char* const CounterNames[CounterCount] =
+{
+    "rays",
+    "sphere tests",
+    "triangle tests",
+    "object tests",
+    "nodes visited",
+    "bounces",
+    "paths escaped",
+    "paths truncated",
+    "paths rouletted",
+    "shadow rays"
+};
+
+static const char* const TimerNames[TimerCount] =
+{
+    "camera rays",
+    "raycast",
+    "bsdf",
+    "accumulate",
+    "blit"
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+const char*
+GetCounterName(Counter counter)
+{
+    return CounterNames[counter];
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+const char*
+GetTimerName(Timer timer)
+{
+    return TimerNames[timer];
+}
+
+#ifdef TRAYRACER_PROFILE
+
+// threads past this many still record, but into a block nobody reads
+static constexpr unsigned MaxThreads = 256;
+// caps the memory a long session spends on the trace
+static constexpr size_t MaxEventsPerThread = 1 << 20;
+static constexpr size_t MaxFrames = 1 << 16;
+
+thread_local ThreadData* currentThread = nullptr;
+
+// registered blocks, only ever appended to. Slots are published with a
+// release store after the block is constructed, so readers never lock
+static std::atomic<ThreadData*> threads[MaxThreads];
+static std::atomic<unsigned> threadCount{ 0 };
+
+// everything below is only touched by the thread ending the frames
+static std::vector<FrameStats> frames;
+// end of every frame in frames, for the trace
+static std::vector<uint64_t> frameEnds;
+static uint64_t lastFrameEnd = 0;
+static FrameStats intervalStats;
+static unsigned intervalFrames = 0;
+static unsigned statsInterval = 0;
+static FILE* statsFile = nullptr;
+
+static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+//------------------------------------------------------------------------------
+/**
+*/
+uint64_t
+Now()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+//------------------------------------------------------------------------------
+/**
+    Blocks are never freed, a thread that exits leaves its events behind for
+    the trace.
+*/
+ThreadData&
+RegisterThread()
+{
+    ThreadData* thread = new ThreadData();
+    const unsigned index = threadCount.fetch_add(1, std::memory_order_relaxed);
+    thread->index = index;
+    if (index < MaxThreads)
+        threads[index].store(thread, std::memory_order_release);
+    currentThread = thread;
+    return *thread;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+AddEvent(const char* name, uint64_t begin, uint64_t end)
+{
+    ThreadData& thread = GetThreadData();
+    if (thread.events.size() >= MaxEventsPerThread)
+    {
+        thread.droppedEvents++;
+        return;
+    }
+    thread.events.push_back({ name, begin, end });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+EndFrame(unsigned frame)
+{
+    const uint64_t now = Now();
+    FrameStats stats;
+    stats.frame = frame;
+    stats.milliseconds = (now - lastFrameEnd) * 1e-6;
+    lastFrameEnd = now;
+
+    const unsigned count = std::min(threadCount.load(std::memory_order_relaxed), MaxThreads);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        // a thread that is still registering is counted next frame
+        ThreadData* thread = threads[i].load(std::memory_order_acquire);
+        if (thread == nullptr)
+            continue;
+        for (unsigned c = 0; c < CounterCount; ++c)
+        {
+            stats.counters[c] += thread->counters[c];
+            thread->counters[c] = 0;
+        }
+        for (unsigned t = 0; t < TimerCount; ++t)
+        {
+            stats.timerMilliseconds[t] += thread->timers[t] * 1e-6;
+            thread->timers[t] = 0;
+        }
+    }
+
+    if (frames.size() < MaxFrames)
+    {
+        frames.push_back(stats);
+        frameEnds.push_back(now);
+    }
+
+    if (statsInterval == 0)
+        return;
+    intervalStats.frame = frame;
+    intervalStats.milliseconds += stats.milliseconds;
+    for (unsigned c = 0; c < CounterCount; ++c)
+    {
+        intervalStats.counters[c] += stats.counters[c];
+    }
+    for (unsigned t = 0; t < TimerCount; ++t)
+    {
+        intervalStats.timerMilliseconds[t] += stats.timerMilliseconds[t];
+    }
+    if (++intervalFrames == statsInterval)
+    {
+        PrintStats(intervalStats, intervalFrames, statsFile);
+        intervalStats = FrameStats();
+        intervalFrames = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SetStatsInterval(unsigned interval, FILE* file)
+{
+    statsInterval = interval;
+    statsFile = file;
+    intervalStats = FrameStats();
+    intervalFrames = 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Must not be called while any thread is recording. Scopes become complete
+    ("X") events on the thread that recorded them, the frame totals become
+    counter ("C") events at the end of their frame.
+*/
+bool
+WriteChromeTrace(std::string const& path)
+{
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+        return false;
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const char* separator = "";
+    const unsigned count = std::min(threadCount.load(std::memory_order_relaxed), MaxThreads);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        ThreadData const* thread = threads[i].load(std::memory_order_acquire);
+        if (thread == nullptr)
+            continue;
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}", separator, thread->index, thread->index);
+        separator = ",\n";
+        for (Event const& event : thread->events)
+        {
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                event.name, thread->index, event.begin * 1e-3, (event.end - event.begin) * 1e-3);
+        }
+        if (thread->droppedEvents > 0)
+            fprintf(stderr, "thread %u dropped %llu trace events\n", thread->index, (unsigned long long)thread->droppedEvents);
+    }
+
+    for (size_t f = 0; f < frames.size(); ++f)
+    {
+        FrameStats const& stats = frames[f];
+        fprintf(file, "%s{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {", separator, frameEnds[f] * 1e-3);
+        separator = ",\n";
+        for (unsigned c = 0; c < CounterCount; ++c)
+        {
+            fprintf(file, "%s\"%s\": %llu", c > 0 ? ", " : "", CounterNames[c], (unsigned long long)stats.counters[c]);
+        }
+        fprintf(file, "}},\n{\"name\": \"thread ms\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {", frameEnds[f] * 1e-3);
+        for (unsigned t = 0; t < TimerCount; ++t)
+        {
+            fprintf(file, "%s\"%s\": %.3f", t > 0 ? ", " : "", TimerNames[t], stats.timerMilliseconds[t]);
+        }
+        fprintf(file, "}}");
+    }
+    fprintf(file, "\n]}\n");
+
+    const bool written = ferror(file) == 0;
+    return fclose(file) == 0 && written;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+IsEnabled()
+{
+    return true;
+}
+
+#else
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+EndFrame(unsigned /*frame*/)
+{
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SetStatsInterval(unsigned /*interval*/, FILE* /*file*/)
+{
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+WriteChromeTrace(std::string const& /*path*/)
+{
+    return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+IsEnabled()
+{
+    return false;
+}
+
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    Counts are given per ray where that is what one wants to compare
+*/
+void
+PrintStats(FrameStats const& stats, unsigned frames, FILE* file)
+{
+    const double rays = (double)std::max<uint64_t>(stats.counters[CounterRays], 1);
+    fprintf(file, "frames %u-%u: %.2f ms/frame, %.2f Mrays/s\n", stats.frame + 1 - frames, stats.frame,
+        stats.milliseconds / frames, stats.counters[CounterRays] / (stats.milliseconds * 1e3));
+    for (unsigned c = 0; c < CounterCount; ++c)
+    {
+        fprintf(file, "  %-16s %14llu  %8.3f/ray\n", CounterNames[c], (unsigned long long)stats.counters[c], stats.counters[c] / rays);
+    }
+    double total = 0.0;
+    for (unsigned t = 0; t < TimerCount; ++t)
+    {
+        total += stats.timerMilliseconds[t];
+    }
+    for (unsigned t = 0; t < TimerCount; ++t)
+    {
+        fprintf(file, "  %-16s %11.2f ms  %6.1f%%\n", TimerNames[t], stats.timerMilliseconds[t], total > 0.0 ? 100.0 * stats.timerMilliseconds[t] / total : 0.0);
+    }
+}
+
+} // namespace Profile
@@ -0,0 +1,172 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+/**
+    Instrumentation of the hot paths, enabled by building with
+    TRAYRACER_PROFILE. Without it every PROFILE_ macro expands to nothing.
+
+    Every thread counts and times into a block of its own, so recording is a
+    plain add without any synchronization. The blocks are summed up by
+    PROFILE_END_FRAME, which must run while the workers are idle, and the
+    per frame totals can be dumped periodically or written out together
+    with the recorded scopes as a Chrome trace (chrome://tracing, Perfetto).
+*/
+namespace Profile
+{
+
+/// things counted per thread
+enum Counter
+{
+    // rays cast, camera rays and bounces
+    CounterRays,
+    // ray/sphere tests, including masked off SIMD lanes
+    CounterSphereTests,
+    CounterTriangleTests,
+    // calls to Object::Intersect
+    CounterObjectTests,
+    CounterNodesVisited,
+    CounterBounces,
+    // paths that left the scene
+    CounterPathsEscaped,
+    // paths cut off by the bounce limit
+    CounterPathsTruncated,
+    // paths ended by Russian roulette
+    CounterPathsRouletted,
+    // any hit rays toward lights
+    CounterShadowRays,
+
+    CounterCount
+};
+
+/// where time is accumulated per thread
+enum Timer
+{
+    TimerCameraRays,
+    TimerRaycast,
+    TimerBSDF,
+    TimerAccumulate,
+    TimerBlit,
+
+    TimerCount
+};
+
+/// totals of one frame over all threads. Times are summed over the threads
+/// too, so with n busy threads they add up to n times the frame time
+struct FrameStats
+{
+    unsigned frame = 0;
+    // since the previous frame ended
+    double milliseconds = 0.0;
+    uint64_t counters[CounterCount] = {};
+    double timerMilliseconds[TimerCount] = {};
+};
+
+const char* GetCounterName(Counter counter);
+const char* GetTimerName(Timer timer);
+
+#ifdef TRAYRACER_PROFILE
+
+/// a scope recorded for the trace, times in nanoseconds since the profiler started
+struct Event
+{
+    const char* name;
+    uint64_t begin;
+    uint64_t end;
+};
+
+/// per thread recording state, on a cache line of its own
+struct alignas(64) ThreadData
+{
+    uint64_t counters[CounterCount] = {};
+    uint64_t timers[TimerCount] = {};
+    std::vector<Event> events;
+    // events that did not fit any more
+    uint64_t droppedEvents = 0;
+    unsigned index = 0;
+};
+
+// the calling thread's block, or nullptr before its first use
+extern thread_local ThreadData* currentThread;
+
+/// create and register the calling thread's block
+ThreadData& RegisterThread();
+
+/// nanoseconds since the profiler started
+uint64_t Now();
+
+/// the calling thread's block
+inline ThreadData& GetThreadData()
+{
+    ThreadData* thread = currentThread;
+    return thread != nullptr ? *thread : RegisterThread();
+}
+
+inline void Count(Counter counter, uint64_t n)
+{
+    GetThreadData().counters[counter] += n;
+}
+
+/// record a scope for the trace, dropped once a thread has recorded too many
+void AddEvent(const char* name, uint64_t begin, uint64_t end);
+
+/// add the time from construction to destruction to a timer
+class ScopedTimer
+{
+public:
+    ScopedTimer(Timer timer) : timer(timer), begin(Now()) {}
+    ~ScopedTimer() { GetThreadData().timers[this->timer] += Now() - this->begin; }
+private:
+    const Timer timer;
+    const uint64_t begin;
+};
+
+/// record the time from construction to destruction as a trace event. name must be a literal
+class ScopedEvent
+{
+public:
+    ScopedEvent(const char* name) : name(name), begin(Now()) {}
+    ~ScopedEvent() { AddEvent(this->name, this->begin, Now()); }
+private:
+    const char* const name;
+    const uint64_t begin;
+};
+
+#endif
+
+/// sum up the blocks of all threads into the stats of a frame and reset them.
+/// No thread may be recording while this runs
+void EndFrame(unsigned frame);
+
+/// print the totals of every interval frames to file as they complete, 0 turns it off
+void SetStatsInterval(unsigned interval, FILE* file);
+
+/// print stats in a human readable form
+void PrintStats(FrameStats const& stats, unsigned frames, FILE* file);
+
+/// write the recorded scopes and the per frame counters as Chrome trace
+/// event JSON. Returns false if it can't be written, or profiling is off
+bool WriteChromeTrace(std::string const& path);
+
+/// true if built with TRAYRACER_PROFILE
+bool IsEnabled();
+
+} // namespace Profile
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef TRAYRACER_PROFILE
+#define PROFILE_COUNT(counter, n) Profile::Count(Profile::counter, (n))
+#define PROFILE_TIME(timer) Profile::ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(Profile::timer)
+#define PROFILE_SCOPE(name) Profile::ScopedEvent PROFILE_CONCAT(profileEvent, __LINE__)(name)
+#define PROFILE_END_FRAME(frame) Profile::EndFrame(frame)
+#else
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_TIME(timer) ((void)0)
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_END_FRAME(frame) ((void)0)
+#endif
@@ -1,12 +1,60 @@
 #pragma once
 
-/// Produces an xorshift128 pseudo random number.
+//------------------------------------------------------------------------------
+/**
+    A counter based random stream. Every number is a hash of the key and
+    the index of the draw, so a stream needs no history and can be recreated
+    anywhere from its key. That makes a render the same no matter how many
+    threads trace it or in which order the tiles come in.
+*/
+struct RandomState
+{
+    unsigned long long key = 0;
+    unsigned counter = 0;
+};
+
+/// Seed a generator, different seeds give unrelated sequences.
+void SeedRandom(RandomState& state, unsigned long long seed);
+
+/// Produces a 32 bit pseudo random number.
 unsigned FastRandom();
+unsigned FastRandom(RandomState& state);
 
-/// Produces an xorshift128 psuedo based floating point random number in range 0..1
+/// Produces a pseudo random floating point number in range 0..1
 /// Note that this is not a truly random random number generator
 float RandomFloat();
+float RandomFloat(RandomState& state);
 
-/// Produces an xorshift128 psuedo based floating point random number in range -1..1
+/// Produces a pseudo random floating point number in range -1..1
 /// Note that this is not a truly random random number generator
-float RandomFloatNTP();
\ No newline at end of file
+float RandomFloatNTP();
+float RandomFloatNTP(RandomState& state);
+
+//------------------------------------------------------------------------------
+/**
+    splitmix64 finalizer
+*/
+inline unsigned long long
+RandomMix(unsigned long long z)
+{
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+inline unsigned FastRandom(RandomState& state)
+{
+    unsigned long long z = state.key + (unsigned long long)(state.counter++ + 1) * 0x9e3779b97f4a7c15ull;
+    return (unsigned)(RandomMix(z) >> 32);
+}
+
+inline float RandomFloat(RandomState& state)
+{
+    // 24 bits fill the mantissa of a float in [0, 1) exactly
+    return float(FastRandom(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+inline float RandomFloatNTP(RandomState& state)
+{
+    return RandomFloat(state) * 2.0f - 1.0f;
+}
@@ -0,0 +1,79 @@
+#include "raypacket.h"
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+RayPacket::SetFrustum(vec3 const corners[4])
+{
+    vec3 center = corners[0] + corners[1] + corners[2] + corners[3];
+    for (int i = 0; i < 4; ++i)
+    {
+        vec3 n = cross(corners[i], corners[(i + 1) % 4]);
+        // winding depends on the camera transform, so point every plane towards the middle ray
+        if (dot(n, center) < 0)
+            n = -n;
+        this->planes[i] = n;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    The box is outside a plane if even its corner furthest along the plane
+    normal is behind it.
+*/
+bool
+FrustumCull(RayPacket const& packet, BVHNode const& node)
+{
+    const float ox = (float)packet.origin.x;
+    const float oy = (float)packet.origin.y;
+    const float oz = (float)packet.origin.z;
+    for (int i = 0; i < 4; ++i)
+    {
+        vec3 const& n = packet.planes[i];
+        float px = (n.x >= 0 ? node.max[0] : node.min[0]) - ox;
+        float py = (n.y >= 0 ? node.max[1] : node.min[1]) - oy;
+        float pz = (n.z >= 0 ? node.max[2] : node.min[2]) - oz;
+        if (n.x * px + n.y * py + n.z * pz < 0)
+            return true;
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Branch free over the lanes so that the compiler can vectorize it.
+*/
+float
+IntersectNode(RayPacket const& packet, BVHNode const& node, bool hit[RayPacket::Size])
+{
+    const float ox = (float)packet.origin.x;
+    const float oy = (float)packet.origin.y;
+    const float oz = (float)packet.origin.z;
+    const float minX = node.min[0] - ox, maxX = node.max[0] - ox;
+    const float minY = node.min[1] - oy, maxY = node.max[1] - oy;
+    const float minZ = node.min[2] - oz, maxZ = node.max[2] - oz;
+
+    float entry[RayPacket::Size];
+    for (unsigned i = 0; i < RayPacket::Size; ++i)
+    {
+        float tx0 = minX * packet.invDx[i];
+        float tx1 = maxX * packet.invDx[i];
+        float ty0 = minY * packet.invDy[i];
+        float ty1 = maxY * packet.invDy[i];
+        float tz0 = minZ * packet.invDz[i];
+        float tz1 = maxZ * packet.invDz[i];
+        float tmin = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::min(tz0, tz1));
+        float tmax = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+        hit[i] = tmax * SlabExitScale >= tmin && tmin < packet.tMax[i] && tmax > 0.0f;
+        entry[i] = hit[i] ? tmin : FLT_MAX;
+    }
+
+    float nearest = FLT_MAX;
+    for (unsigned i = 0; i < RayPacket::Size; ++i)
+    {
+        nearest = std::min(nearest, entry[i]);
+    }
+    return nearest;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <float.h>
+#include "vec3.h"
+#include "bvh.h"
+
+//------------------------------------------------------------------------------
+/**
+    A bundle of primary rays through a small square block of pixels.
+
+    All rays share the camera position as their origin, so the whole bundle
+    fits inside the frustum spanned by the four block corners. Traversal
+    rejects nodes against that frustum once for the whole packet before
+    testing the individual rays.
+*/
+struct RayPacket
+{
+    static constexpr unsigned Width = 4;
+    static constexpr unsigned Size = Width * Width;
+
+    vec3 origin;
+    float dx[Size], dy[Size], dz[Size];
+    float invDx[Size], invDy[Size], invDz[Size];
+    // closest hit so far, per ray. Lanes outside the image are set to 0 so they never hit anything
+    float tMax[Size];
+
+    // inward facing side planes of the frustum, all through origin
+    vec3 planes[4];
+
+    // set direction of ray i
+    void SetDirection(unsigned i, vec3 const& dir);
+
+    // build the side planes from the directions through the four block corners, in winding order
+    void SetFrustum(vec3 const corners[4]);
+
+    // get ray i
+    Ray GetRay(unsigned i) const;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Returns true if the node is entirely outside the packet frustum. Only
+    ever errs on the side of keeping a node.
+*/
+bool FrustumCull(RayPacket const& packet, BVHNode const& node);
+
+//------------------------------------------------------------------------------
+/**
+    Slab test every ray against the node. Fills in which rays hit, and
+    returns the nearest entry distance, or FLT_MAX if no ray hits.
+*/
+float IntersectNode(RayPacket const& packet, BVHNode const& node, bool hit[RayPacket::Size]);
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline void
+RayPacket::SetDirection(unsigned i, vec3 const& dir)
+{
+    this->dx[i] = (float)dir.x;
+    this->dy[i] = (float)dir.y;
+    this->dz[i] = (float)dir.z;
+    this->invDx[i] = 1.0f / this->dx[i];
+    this->invDy[i] = 1.0f / this->dy[i];
+    this->invDz[i] = 1.0f / this->dz[i];
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline Ray
+RayPacket::GetRay(unsigned i) const
+{
+    return Ray(this->origin, vec3(this->dx[i], this->dy[i], this->dz[i]));
+}
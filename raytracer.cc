@@ -1,50 +1,51 @@
 #include "raytracer.h"
 #include "spinlock.h"
-#include <random>
+#include "profile.h"
+#include <assert.h>
+#include <algorithm>
 #include <atomic>
 
 //------------------------------------------------------------------------------
 /**
-*	funtion to check if a atomic bool is true or false
 */
-static bool testAndSet(atomic<int>& flag)
-{
-	int result = flag.fetch_add(0, std::memory_order_acquire);
-	//check if the old value was 1 which means the bool is true
-	return result == 1;
-}
-//------------------------------------------------------------------------------
-/**
-*/
-Raytracer::Raytracer(unsigned w, unsigned h, std::vector<Color>& frameBuffer, unsigned rpp, unsigned bounces) :
+Raytracer::Raytracer(unsigned w, unsigned h, std::vector<Color>& frameBuffer, unsigned rpp, unsigned bounces, unsigned threads) :
     frameBuffer(frameBuffer),
     rpp(rpp),
     bounces(bounces),
     width(w),
     height(h),
-	threads(threadCount)
+	threadCount(threads != 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u)),
+	pool(threadCount),
+	threadContexts(pool.GetThreadCount()),
+	scheduler(threadCount, tileSize),
+	sampler(new SobolSampler())
 {
-	widthPerThread = width / threadCount;
-	leftOverPixels = width % threadCount;
-	cout << "Width per thread" << widthPerThread << endl;
-	cout << "Left overs: " << leftOverPixels << endl;
-	cout << threadCount << endl;
+	this->frameBuffer.resize(w * h);
+	this->backBuffer.resize(w * h);
+	this->accumulator.Resize(w, h);
+	this->tileRetired.assign(((w + tileSize - 1) / tileSize) * ((h + tileSize - 1) / tileSize), 0);
 }
 //------------------------------------------------------------------------------
 /**
 */
 Raytracer::~Raytracer()
 {
-    for (int i = 0; i < objects.size(); i++)
+	if (this->inFlight)
+		this->pool.Wait();
+
+	// the arena frees the objects' memory in one go once they are destroyed
+    for (Object* object : this->objects)
     {
-		delete objects[i];
+		object->~Object();
     }
 	objects.clear();
-	for (int i = 0; i < materials.size(); i++)
-	{
-		delete materials[i];
-	}
-	materials.clear();
+    for (Mesh* mesh : this->meshes)
+    {
+		mesh->~Mesh();
+    }
+	meshes.clear();
+	delete this->sampler;
+	delete this->sceneFile;
 }
 
 //------------------------------------------------------------------------------
@@ -53,68 +54,253 @@ Raytracer::~Raytracer()
 void
 Raytracer::Raytrace()
 {
-    static int leet = 1337;
-    std::mt19937 generator (leet++);
-    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
-	atomic<int> renderCompleted(0);
-	Spinlock lock;
+	this->BeginRaytrace();
+	this->EndRaytrace();
+}
+
+//------------------------------------------------------------------------------
+/**
+    The camera, the generation and the noise threshold are copied here, so
+    the caller is free to move the camera or Clear while the frame is
+    traced. The other settings (rpp, bounces, rouletteDepth, exposure,
+    tonemap, packetTracing, sampleLights, skyIntensity, adaptiveMinFrames
+    and the sampler) are read by the workers as they go and must not
+    change until EndRaytrace.
+*/
+void
+Raytracer::BeginRaytrace()
+{
+	assert(!this->inFlight);
 
-	for (int i = 0; i < threadCount; ++i)
+	if (this->bvhDirty || this->sphereBvhDirty)
+		this->UpdateAccelerationStructure();
+
+	this->frameView = this->view;
+	this->frameFrustum = this->frustum;
+	this->frameGeneration = this->generation.load(std::memory_order_relaxed);
+	this->frameNoiseThreshold = this->noiseThreshold;
+	this->inFlight = true;
+
+	this->scheduler.Reset(this->width, this->height);
+	this->pool.Dispatch([this](unsigned i)
 	{
-		cout << i << endl;
-		int startX, endX, startY = 0, endY = height;
-		if (i < threadCount -1 || leftOverPixels == 0)
+		ThreadContext& context = this->threadContexts[i];
+		Tile tile;
+		while (this->scheduler.Next(i, tile))
 		{
-			startX = i * (widthPerThread + 1);
-			endX = startX + widthPerThread;
+			PROFILE_SCOPE("Tile");
+			// a retired tile only needs resolving, the back buffer holds it from two frames ago
+			const unsigned index = this->GetTileIndex(tile);
+			if (this->frameNoiseThreshold > 0.0f && this->tileRetired[index])
+			{
+				this->ResolveTile(tile);
+				continue;
+			}
+
+			if (this->packetTracing)
+				this->RenderTilePackets(tile, context);
+			else
+				this->RenderTile(tile, context);
+
+			if (this->frameNoiseThreshold > 0.0f)
+				this->tileRetired[index] = this->IsTileConverged(tile);
 		}
-		else if (leftOverPixels > 0 && i == threadCount - 1)
+	});
+}
+
+//------------------------------------------------------------------------------
+/**
+    Every frame runs to completion and is swapped to the front, even if
+    Clear was called while it was traced. The viewer clears on every bit of
+    camera motion, so throwing such frames away would leave it showing the
+    image from before the motion until the input stops. What a Clear drops
+    is the accumulation, once the frame is on screen.
+*/
+bool
+Raytracer::EndRaytrace()
+{
+	assert(this->inFlight);
+	{
+		PROFILE_SCOPE("Wait for frame");
+		this->pool.Wait();
+	}
+	this->inFlight = false;
+	// the workers are idle until the next BeginRaytrace
+	PROFILE_END_FRAME(this->frameIndex);
+
+	// swaps the storage, not the contents
+	std::swap(this->frameBuffer, this->backBuffer);
+
+	if (this->generation.load(std::memory_order_relaxed) != this->frameGeneration)
+	{
+		this->accumulator.Clear();
+		std::fill(this->tileRetired.begin(), this->tileRetired.end(), 0);
+		this->frameIndex = 0;
+		return false;
+	}
+	this->frameIndex++;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+vec3
+Raytracer::GetCameraDirection(float x, float y) const
+{
+    float u = ((x * (1.0f / this->width)) * 2.0f) - 1.0f;
+    float v = ((y * (1.0f / this->height)) * 2.0f) - 1.0f;
+    return transform(vec3(u, v, -1.0f), this->frameFrustum);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::RenderTile(Tile const& tile, ThreadContext& context)
+{
+	for (unsigned y = tile.y0; y < tile.y1; ++y)
+	{
+		for (unsigned x = tile.x0; x < tile.x1; ++x)
 		{
-			startX = i * widthPerThread;
-			endX = startX * widthPerThread + leftOverPixels;
+			Color color;
+			for (int i = 0; i < this->rpp; ++i)
+			{
+				vec3 direction;
+				{
+					PROFILE_TIME(TimerCameraRays);
+					// bounce 0 of the sample jitters the camera ray
+					context.samples = BeginSample(this->sampler, x, y, this->frameIndex * this->rpp + i);
+					const float jx = NextSample(context.samples);
+					const float jy = NextSample(context.samples);
+					direction = this->GetCameraDirection(float(x + jx), float(y + jy));
+				}
+				Ray ray = Ray(get_position(this->frameView), direction);
+				color += this->TracePath(ray, 0, context);
+			}
+			// divide by number of samples per pixel, to get the average of the distribution
+			color.r /= this->rpp;
+			color.g /= this->rpp;
+			color.b /= this->rpp;
+
+			// tiles never overlap, so this pixel belongs to this thread alone
+			PROFILE_TIME(TimerAccumulate);
+			this->accumulator.Add(y * this->width + x, color);
 		}
-		threads[i] = std::thread([this, &dis, &generator, &renderCompleted, startX, startY, endX, endY, &lock, &i]()
+	}
+	this->ResolveTile(tile);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Primary rays of a 4x4 pixel block are traced together. Secondary rays
+    scatter in all directions, so from the first bounce on every path
+    continues on its own through TracePath.
+*/
+void
+Raytracer::RenderTilePackets(Tile const& tile, ThreadContext& context)
+{
+	const unsigned W = RayPacket::Width;
+	const SceneView scene = this->GetSceneView();
+
+	RayPacket packet;
+	packet.origin = get_position(this->frameView);
+	HitResult hits[RayPacket::Size];
+
+	for (unsigned by = tile.y0; by < tile.y1; by += W)
+	{
+		for (unsigned bx = tile.x0; bx < tile.x1; bx += W)
 		{
-			while (!testAndSet(renderCompleted))
+			// every jittered ray stays within its pixel, so the block corners bound them all
+			const vec3 corners[4] =
 			{
-				for (int y = startY; y <= endY; ++y)
+				this->GetCameraDirection(float(bx), float(by)),
+				this->GetCameraDirection(float(bx + W), float(by)),
+				this->GetCameraDirection(float(bx + W), float(by + W)),
+				this->GetCameraDirection(float(bx), float(by + W))
+			};
+			packet.SetFrustum(corners);
+
+			Color colors[RayPacket::Size];
+			for (unsigned s = 0; s < this->rpp; ++s)
+			{
+				for (unsigned i = 0; i < RayPacket::Size; ++i)
 				{
-					for (int x = startX; x <= endX; ++x)
+					PROFILE_TIME(TimerCameraRays);
+					const unsigned x = bx + i % W;
+					const unsigned y = by + i / W;
+					if (x < tile.x1 && y < tile.y1)
 					{
-						Color color;
-						for (int i = 0; i < this->rpp; ++i)
-						{
-							float u = ((float(x + dis(generator)) * (1.0f / this->width)) * 2.0f) - 1.0f;
-							float v = ((float(y + dis(generator)) * (1.0f / this->height)) * 2.0f) - 1.0f;
-
-							vec3 direction = vec3(u, v, -1.0f);
-							direction = transform(direction, this->frustum);
-
-							Ray ray = Ray(get_position(this->view), direction);
-							color += this->TracePath(ray, 0);
-							// delete ray;
-						}
-						// divide by number of samples per pixel, to get the average of the distribution
-						color.r /= this->rpp;
-						color.g /= this->rpp;
-						color.b /= this->rpp;
-						{
-							cout << "Here: " << i << endl;
-							lock.lock();
-							frameBuffer[y * this->width + x] += color;
-							lock.unlock();
-						}
+						SampleStream samples = BeginSample(this->sampler, x, y, this->frameIndex * this->rpp + s);
+						const float jx = NextSample(samples);
+						const float jy = NextSample(samples);
+						packet.SetDirection(i, this->GetCameraDirection(float(x + jx), float(y + jy)));
+						packet.tMax[i] = FLT_MAX;
+						context.rayCount++;
+						PROFILE_COUNT(CounterRays, 1);
+					}
+					else
+					{
+						// outside the tile, keep the lane but make sure it hits nothing
+						packet.SetDirection(i, corners[0]);
+						packet.tMax[i] = 0.0f;
 					}
 				}
+
+				RaycastPacket(packet, hits, scene);
+
+				for (unsigned i = 0; i < RayPacket::Size; ++i)
+				{
+					if (packet.tMax[i] == 0.0f)
+						continue;
+
+					// Shade picks the sample up at bounce 1
+					context.samples = BeginSample(this->sampler, bx + i % W, by + i / W, this->frameIndex * this->rpp + s);
+					Ray ray = packet.GetRay(i);
+					if (hits[i].t < FLT_MAX)
+					{
+						colors[i] += this->Shade(ray, hits[i], 0, context);
+					}
+					else
+					{
+						PROFILE_COUNT(CounterPathsEscaped, 1);
+						colors[i] += this->Skybox(ray.m);
+					}
+				}
+			}
+
+			for (unsigned i = 0; i < RayPacket::Size; ++i)
+			{
+				const unsigned x = bx + i % W;
+				const unsigned y = by + i / W;
+				if (x >= tile.x1 || y >= tile.y1)
+					continue;
+
+				Color color = colors[i];
+				color.r /= this->rpp;
+				color.g /= this->rpp;
+				color.b /= this->rpp;
+				PROFILE_TIME(TimerAccumulate);
+				this->accumulator.Add(y * this->width + x, color);
 			}
-		});
+		}
 	}
-	renderCompleted.store(1, std::memory_order_release);
-	for (auto& thread : threads)
+	this->ResolveTile(tile);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Done right after the tile is traced, while its pixels are still in cache.
+*/
+void
+Raytracer::ResolveTile(Tile const& tile)
+{
+	PROFILE_TIME(TimerAccumulate);
+	for (unsigned y = tile.y0; y < tile.y1; ++y)
 	{
-		thread.join();
+		const unsigned first = y * this->width + tile.x0;
+		this->accumulator.Resolve(&this->backBuffer[first], first, tile.x1 - tile.x0, this->exposure, this->tonemap);
 	}
-  
 }
 
 //------------------------------------------------------------------------------
@@ -122,88 +308,474 @@ Raytracer::Raytrace()
  * @parameter n - the current bounce level
 */
 Color
-Raytracer::TracePath(Ray ray, unsigned n)
+Raytracer::TracePath(Ray const& ray, unsigned n, ThreadContext& context)
+{
+    HitResult hit;
+    context.rayCount++;
+    PROFILE_COUNT(CounterRays, 1);
+
+    if (Raycast(ray, hit, this->GetSceneView()))
+    {
+        return this->Shade(ray, hit, n, context);
+    }
+
+    PROFILE_COUNT(CounterPathsEscaped, 1);
+    return this->Skybox(ray.m);
+}
+
+//------------------------------------------------------------------------------
+/**
+    MIS weight of the technique that drew a sample with pdf, against one
+    drawing it with otherPdf. Power heuristic with an exponent of 2
+*/
+static inline float
+PowerHeuristic(float pdf, float otherPdf)
+{
+    const float a = pdf * pdf;
+    const float b = otherPdf * otherPdf;
+    return a > 0.0f ? a / (a + b) : 0.0f;
+}
+
+//------------------------------------------------------------------------------
+/**
+    1 - cos of the half angle of the cone a sphere of radius squared r2
+    covers, seen from dist2 away. Written so it keeps its precision for
+    small and distant spheres
+*/
+static inline float
+GetConeSpread(float r2, float dist2)
+{
+    const float x = r2 / dist2;
+    return x / (1.0f + sqrtf(1.0f - x));
+}
+
+//------------------------------------------------------------------------------
+/**
+    Solid angle pdf of SampleLight picking a direction from p toward the
+    light sphere. 0 if p is inside it, SampleLight never samples it from there
+*/
+static float
+GetLightPdf(SceneView const& scene, unsigned sphere, vec3 p)
+{
+    SphereStore const& spheres = *scene.spheres;
+    const vec3 d = vec3(spheres.centerX[sphere], spheres.centerY[sphere], spheres.centerZ[sphere]) - p;
+    const float dist2 = (float)dot(d, d);
+    const float r2 = spheres.radius[sphere] * spheres.radius[sphere];
+    if (dist2 <= r2)
+        return 0.0f;
+    return 1.0f / (scene.lightCount * 2.0f * (float)MPI * GetConeSpread(r2, dist2));
+}
+
+//------------------------------------------------------------------------------
+/**
+    True if anything is hit nearer than tMax. Stops at the first hit found
+*/
+static bool
+IsOccluded(Ray const& ray, float tMax, SceneView const& scene)
+{
+    PROFILE_COUNT(CounterShadowRays, 1);
+    bool occluded = scene.sphereBvh->IntersectAny(ray, tMax, [&scene, &ray](unsigned first, unsigned count, float& tMax)
+    {
+        unsigned sphere;
+        return scene.spheres->Intersect(ray, first, count, tMax, sphere);
+    });
+    if (occluded)
+        return true;
+
+    return scene.bvh->IntersectAny(ray, tMax, [&scene, &ray](unsigned first, unsigned count, float& tMax)
+    {
+        PROFILE_COUNT(CounterObjectTests, count);
+        HitResult hit;
+        for (unsigned i = first; i < first + count; ++i)
+        {
+            if (scene.objects[scene.bvh->indices[i]]->Intersect(ray, tMax, hit))
+                return true;
+        }
+        return false;
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+    Next event estimation: light reaching hit through the diffuse lobe from
+    a direction drawn uniformly in the cone of one light sphere, picked
+    uniformly among the lights. Weighted against the diffuse lobe of BSDF
+    drawing the same direction, which Shade does the other half of.
+*/
+static Color
+SampleLight(SceneView const& scene, Material const& material, Ray const& ray, HitResult const& hit, SampleStream& samples)
+{
+    const unsigned light = std::min(unsigned(NextSample(samples) * scene.lightCount), scene.lightCount - 1);
+    const float u = NextSample(samples);
+    const float v = NextSample(samples);
+
+    const unsigned sphere = scene.lights[light];
+    SphereStore const& spheres = *scene.spheres;
+    const vec3 d = vec3(spheres.centerX[sphere], spheres.centerY[sphere], spheres.centerZ[sphere]) - hit.p;
+    const float dist2 = (float)dot(d, d);
+    const float r2 = spheres.radius[sphere] * spheres.radius[sphere];
+    if (dist2 <= r2)
+        return {};
+
+    const float spread = GetConeSpread(r2, dist2);
+    const float cosTheta = 1.0f - u * spread;
+    const float sinTheta = sqrtf(fmaxf(0.0f, 1.0f - cosTheta * cosTheta));
+    const float phi = 2.0f * (float)MPI * v;
+    const mat4 basis = TBN(d * (1.0f / sqrtf(dist2)));
+    const vec3 direction = normalize(get_row0(basis) * (sinTheta * cosf(phi)) + get_row1(basis) * cosTheta + get_row2(basis) * (sinTheta * sinf(phi)));
+
+    const vec3 normal = normalize(hit.normal);
+    const float cosSurface = (float)dot(normal, direction);
+    if (cosSurface <= 0.0f)
+        return {};
+
+    // stop short of the near side of the light, so it doesn't shadow itself
+    const float b = (float)dot(d, direction);
+    const float t = b - sqrtf(fmaxf(b * b - dist2 + r2, 0.0f));
+    if (IsOccluded(Ray(hit.p, direction), t * 0.999f, scene))
+        return {};
+
+    const float diffuse = 1.0f - GetSpecularProbability(&material, ray, hit.normal);
+    const float lightPdf = 1.0f / (scene.lightCount * 2.0f * (float)MPI * spread);
+    const float bsdfPdf = diffuse * cosSurface / (float)MPI;
+    Color const& radiance = scene.materials[spheres.material[sphere]].color;
+    // the diffuse lobe is color / pi, scaled by its share of the BSDF
+    return radiance * material.color * (diffuse / (float)MPI * cosSurface * PowerHeuristic(lightPdf, bsdfPdf) / lightPdf);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Follows the path bounce by bounce, keeping the product of the surface
+    colors seen so far in throughput instead of recursing.
+
+    Past rouletteDepth a path survives each bounce with a probability equal
+    to its largest throughput channel, and the survivors are weighted up by
+    its inverse. That keeps the estimate unbiased while paths that could add
+    little to the pixel stop early.
+
+    Emissive surfaces add their light and end the path. With sampleLights,
+    light spheres are also sampled directly at every surface with a diffuse
+    lobe, and a BSDF sample running into one is weighted by MIS so the two
+    don't count the same light twice.
+
+ * @parameter n - the bounce level the hit was found at
+*/
+Color
+Raytracer::Shade(Ray const& ray, HitResult const& firstHit, unsigned n, ThreadContext& context)
 {
-    vec3 hitPoint;
-    vec3 hitNormal;
-    Object* hitObject = nullptr;
-    float distance = FLT_MAX;
+    const SceneView scene = this->GetSceneView();
+    const bool sampleLights = this->sampleLights && scene.lightCount > 0;
+    Color radiance;
+    Color throughput = { 1.0f, 1.0f, 1.0f };
+    Ray current = ray;
+    HitResult hit = firstHit;
+    // pdf of the last direction if it came from the diffuse lobe, 0 otherwise
+    float diffusePdf = 0.0f;
 
-    if (Raycast(ray, hitPoint, hitNormal, hitObject, distance, this->objects))
+    while (true)
     {
-        Ray scatteredRay = Ray(hitObject->ScatterRay(ray, hitPoint, hitNormal));
-        if (n < this->bounces)
+        Material const& material = scene.materials[hit.material];
+        if (material.type == Emissive)
         {
-            return hitObject->GetColor() * this->TracePath(scatteredRay, n + 1);
+            float weight = 1.0f;
+            if (sampleLights && diffusePdf > 0.0f && hit.sphere != HitResult::NoSphere)
+                weight = PowerHeuristic(diffusePdf, GetLightPdf(scene, hit.sphere, current.b));
+            return radiance + throughput * material.color * weight;
         }
 
-        if (n == this->bounces)
+        if (n >= this->bounces)
         {
-            return {0,0,0};
+            // out of bounces while still hitting things
+            PROFILE_COUNT(CounterPathsTruncated, 1);
+            return radiance;
+        }
+
+        if (sampleLights && material.type != Dielectric)
+        {
+            SetSampleLight(context.samples, n + 1);
+            radiance += throughput * SampleLight(scene, material, current, hit, context.samples);
+        }
+
+        SetSampleBounce(context.samples, n + 1);
+        {
+            PROFILE_TIME(TimerBSDF);
+            current = BSDF(&material, current, hit.p, hit.normal, context.samples, diffusePdf);
+        }
+        throughput = throughput * material.color;
+        n++;
+
+        if (n >= this->rouletteDepth)
+        {
+            const float survival = std::min(std::max(throughput.r, std::max(throughput.g, throughput.b)), 1.0f);
+            if (GetRouletteSample(context.samples, n) >= survival)
+            {
+                context.rouletteCount++;
+                PROFILE_COUNT(CounterPathsRouletted, 1);
+                return radiance;
+            }
+            throughput = throughput * (1.0f / survival);
+        }
+
+        context.rayCount++;
+        PROFILE_COUNT(CounterRays, 1);
+        PROFILE_COUNT(CounterBounces, 1);
+        if (!Raycast(current, hit, scene))
+        {
+            PROFILE_COUNT(CounterPathsEscaped, 1);
+            return radiance + throughput * this->Skybox(current.m);
         }
     }
+}
 
-    return this->Skybox(ray.m);
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::UpdateAccelerationStructure()
+{
+    PROFILE_SCOPE("Build BVH");
+    std::vector<AABB> bounds;
+    if (this->bvhDirty)
+    {
+        bounds.resize(this->objects.size());
+        for (size_t i = 0; i < this->objects.size(); ++i)
+        {
+            bounds[i] = this->objects[i]->GetBounds();
+        }
+        this->bvh.Build(bounds);
+        this->bvhDirty = false;
+    }
+
+    // sort the spheres into leaf order, so that each leaf is one batch for the SIMD kernel
+    if (this->sphereBvhDirty)
+    {
+        bounds.resize(this->spheres.Size());
+        for (unsigned i = 0; i < this->spheres.Size(); ++i)
+        {
+            bounds[i] = this->spheres.GetBounds(i);
+        }
+        this->sphereBvh.Build(bounds);
+        this->spheres.Reorder(this->sphereBvh.indices);
+        for (unsigned i = 0; i < this->spheres.Size(); ++i)
+        {
+            this->sphereBvh.indices[i] = i;
+        }
+        this->sphereBvhDirty = false;
+        this->UpdateLights();
+    }
 }
 
 //------------------------------------------------------------------------------
 /**
 */
-bool
-Raytracer::Raycast(Ray ray, vec3& hitPoint, vec3& hitNormal, Object*& hitObject, float& distance, std::vector<Object*> world)
+void
+Raytracer::UpdateLights()
 {
-    bool isHit = false;
-    HitResult closestHit;
-    int numHits = 0;
-    HitResult hit;
+    this->lights.clear();
+    for (unsigned i = 0; i < this->spheres.Size(); ++i)
+    {
+        if (this->materials[this->spheres.material[i]].type == Emissive)
+            this->lights.push_back(i);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    The file's spheres are already in leaf order, so the only thing copied
+    out of it is the node array. Spheres added afterwards copy the store out
+    of the mapping and rebuild the sphere BVH as usual.
+*/
+void
+Raytracer::AttachScene(SceneFile* file)
+{
+    assert(!this->inFlight);
+    SceneFileHeader const& header = file->GetHeader();
+
+    this->spheres.SetView(file->GetCenterX(), file->GetCenterY(), file->GetCenterZ(), file->GetRadius(), file->GetMaterialIndices(), header.sphereCount);
+
+    this->materials.SetView(file->GetMaterials(), header.materialCount);
+
+    BVHNode const* nodes = file->GetNodes();
+    this->sphereBvh.nodes.assign(nodes, nodes + header.nodeCount);
+    this->sphereBvh.indices.resize(header.sphereCount);
+    for (unsigned i = 0; i < header.sphereCount; ++i)
+    {
+        this->sphereBvh.indices[i] = i;
+    }
+    this->sphereBvhDirty = false;
+    this->UpdateLights();
+
+    // only now that nothing points into the old file any more
+    delete this->sceneFile;
+    this->sceneFile = file;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Fill in the hit record for a sphere from the sphere store, hit.t must be set
+*/
+static void
+SetSphereHit(Ray const& ray, unsigned sphere, SceneView const& scene, HitResult& hit)
+{
+    SphereStore const& spheres = *scene.spheres;
+    hit.p = ray.PointAt(hit.t);
+    vec3 center = vec3(spheres.centerX[sphere], spheres.centerY[sphere], spheres.centerZ[sphere]);
+    hit.normal = (hit.p - center) * (1.0f / spheres.radius[sphere]);
+    hit.material = spheres.material[sphere];
+    hit.sphere = sphere;
+    hit.object = nullptr;
+}
 
-    //// First, sort the world objects
-    //std::sort(world.begin(), world.end());
-
-    //// then add all objects into a remaining objects set of unique objects, so that we don't trace against the same object twice
-    //std::vector<Object*> uniqueObjects;
-    //for (size_t i = 0; i < world.size(); ++i)
-    //{
-    //    Object* obj = world[i];
-    //    std::vector<Object*>::iterator it = std::find_if(uniqueObjects.begin(), uniqueObjects.end(), 
-    //            [obj](const auto& val)
-    //            {
-    //                return (obj->GetName() == val->GetName() && obj->GetId() == val->GetId());
-    //            }
-    //        );
-
-    //    if (it == uniqueObjects.end())
-    //    {
-    //        uniqueObjects.push_back(obj);
-    //    }
-    //}
-
-    for (auto object : world)
-    {
-        /*auto objectIt = uniqueObjects.begin();
-        Object* object = *objectIt;*/
-
-        auto opt = object->Intersect(ray, closestHit.t);
-        if (opt.HasValue())
+//------------------------------------------------------------------------------
+/**
+    Find a closer hit than closestHit among the scene objects
+*/
+static bool
+RaycastObjects(Ray const& ray, HitResult& closestHit, SceneView const& scene)
+{
+    return scene.bvh->Intersect(ray, closestHit.t, [&scene, &ray, &closestHit](unsigned first, unsigned count, float& tMax)
+    {
+        PROFILE_COUNT(CounterObjectTests, count);
+        bool isHit = false;
+        for (unsigned i = first; i < first + count; ++i)
         {
-            hit = opt.Get();
-            assert(hit.t < closestHit.t);
-            closestHit = hit;
-            closestHit.object = object;
-            isHit = true;
-            numHits++;
+            Object* object = scene.objects[scene.bvh->indices[i]];
+            // Intersect only writes the hit if it is closer than tMax
+            if (object->Intersect(ray, tMax, closestHit))
+            {
+                closestHit.object = object;
+                closestHit.sphere = HitResult::NoSphere;
+                tMax = closestHit.t;
+                isHit = true;
+            }
         }
-       // uniqueObjects.erase(objectIt);
+        return isHit;
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+Raytracer::Raycast(Ray const& ray, HitResult& closestHit, SceneView const& scene)
+{
+    PROFILE_TIME(TimerRaycast);
+    closestHit = HitResult();
+
+    unsigned sphere = 0;
+    bool sphereHit = scene.sphereBvh->Intersect(ray, closestHit.t, [&scene, &ray, &sphere](unsigned first, unsigned count, float& tMax)
+    {
+        return scene.spheres->Intersect(ray, first, count, tMax, sphere);
+    });
+    if (sphereHit)
+    {
+        SetSphereHit(ray, sphere, scene, closestHit);
     }
 
-    hitPoint = closestHit.p;
-    hitNormal = closestHit.normal;
-    hitObject = closestHit.object;
-    distance = closestHit.t;
-    
-    return isHit;
+    bool objectHit = RaycastObjects(ray, closestHit, scene);
+    return sphereHit || objectHit;
 }
 
+//------------------------------------------------------------------------------
+/**
+    The packet walks the sphere BVH as a whole: a node is visited once for all
+    rays, and skipped outright when it is outside the packet frustum. Only
+    the rays that actually enter a leaf test its spheres.
+*/
+void
+Raytracer::RaycastPacket(RayPacket& packet, HitResult hits[RayPacket::Size], SceneView const& scene)
+{
+    PROFILE_TIME(TimerRaycast);
+    unsigned sphere[RayPacket::Size];
+    for (unsigned i = 0; i < RayPacket::Size; ++i)
+    {
+        sphere[i] = ~0u;
+    }
+
+    BVH const& bvh = *scene.sphereBvh;
+    bool laneHit[RayPacket::Size];
+    if (!bvh.IsEmpty() && !FrustumCull(packet, bvh.nodes[0]) && IntersectNode(packet, bvh.nodes[0], laneHit) != FLT_MAX)
+    {
+        struct Entry
+        {
+            unsigned node;
+            float t;
+        };
+        Entry stack[64];
+        unsigned stackSize = 0;
+        unsigned current = 0;
+
+        while (true)
+        {
+            BVHNode const& node = bvh.nodes[current];
+            PROFILE_COUNT(CounterNodesVisited, 1);
+            if (node.IsLeaf())
+            {
+                IntersectNode(packet, node, laneHit);
+                for (unsigned i = 0; i < RayPacket::Size; ++i)
+                {
+                    if (laneHit[i])
+                        scene.spheres->Intersect(packet.GetRay(i), node.leftFirst, node.count, packet.tMax[i], sphere[i]);
+                }
+            }
+            else
+            {
+                unsigned near = node.leftFirst;
+                unsigned far = node.leftFirst + 1;
+                float tNear = FrustumCull(packet, bvh.nodes[near]) ? FLT_MAX : IntersectNode(packet, bvh.nodes[near], laneHit);
+                float tFar = FrustumCull(packet, bvh.nodes[far]) ? FLT_MAX : IntersectNode(packet, bvh.nodes[far], laneHit);
+                if (tFar < tNear)
+                {
+                    std::swap(near, far);
+                    std::swap(tNear, tFar);
+                }
+
+                if (tNear != FLT_MAX)
+                {
+                    if (tFar != FLT_MAX)
+                        stack[stackSize++] = { far, tFar };
+                    current = near;
+                    continue;
+                }
+            }
+
+            // pop the next node that some ray might still hit closer than what it has
+            float farthest = 0.0f;
+            for (unsigned i = 0; i < RayPacket::Size; ++i)
+            {
+                farthest = std::max(farthest, packet.tMax[i]);
+            }
+            bool found = false;
+            while (stackSize > 0)
+            {
+                Entry entry = stack[--stackSize];
+                if (entry.t < farthest)
+                {
+                    current = entry.node;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found)
+                break;
+        }
+    }
+
+    for (unsigned i = 0; i < RayPacket::Size; ++i)
+    {
+        hits[i] = HitResult();
+        if (packet.tMax[i] == 0.0f)
+            continue;
+
+        Ray ray = packet.GetRay(i);
+        if (sphere[i] != ~0u)
+        {
+            hits[i].t = packet.tMax[i];
+            SetSphereHit(ray, sphere[i], scene, hits[i]);
+        }
+        RaycastObjects(ray, hits[i], scene);
+    }
+}
 
 //------------------------------------------------------------------------------
 /**
@@ -211,12 +783,55 @@ Raytracer::Raycast(Ray ray, vec3& hitPoint, vec3& hitNormal, Object*& hitObject,
 void
 Raytracer::Clear()
 {
-    for (auto& color : this->frameBuffer)
+    this->generation++;
+    if (this->inFlight)
     {
-        color.r = 0.0f;
-        color.g = 0.0f;
-        color.b = 0.0f;
+        // the workers are still writing, EndRaytrace clears once they are done
+        return;
+    }
+    this->accumulator.Clear();
+    std::fill(this->tileRetired.begin(), this->tileRetired.end(), 0);
+    this->frameIndex = 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+unsigned
+Raytracer::GetActiveTileCount() const
+{
+    if (this->noiseThreshold <= 0.0f)
+        return (unsigned)this->tileRetired.size();
+    return (unsigned)std::count(this->tileRetired.begin(), this->tileRetired.end(), 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+Raytracer::IsConverged() const
+{
+    return this->GetActiveTileCount() == 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The tile is as noisy as its noisiest pixel, so a small bright feature
+    keeps the whole tile going.
+*/
+bool
+Raytracer::IsTileConverged(Tile const& tile) const
+{
+    for (unsigned y = tile.y0; y < tile.y1; ++y)
+    {
+        for (unsigned x = tile.x0; x < tile.x1; ++x)
+        {
+            const unsigned pixel = y * this->width + x;
+            if (this->accumulator.GetCount(pixel) < this->adaptiveMinFrames || this->accumulator.GetError(pixel) >= this->frameNoiseThreshold)
+                return false;
+        }
     }
+    return true;
 }
 
 //------------------------------------------------------------------------------
@@ -236,7 +851,7 @@ Raytracer::UpdateMatrices()
 Color
 Raytracer::Skybox(vec3 direction)
 {
-    float t = 0.5*(direction.y + 1.0);
-    vec3 vec = vec3(1.0, 1.0, 1.0) * (1.0 - t) + vec3(0.5, 0.7, 1.0) * t;
+    float t = 0.5f*(direction.y + 1.0f);
+    vec3 vec = (vec3(1.0f, 1.0f, 1.0f) * (1.0f - t) + vec3(0.5f, 0.7f, 1.0f) * t) * this->skyIntensity;
     return {(float)vec.x, (float)vec.y, (float)vec.z};
 }
@@ -8,51 +8,162 @@
 #include "color.h"
 #include "ray.h"
 #include "object.h"
+#include "bvh.h"
+#include "scene.h"
+#include "raypacket.h"
+#include "tilescheduler.h"
+#include "threadpool.h"
+#include "sampler.h"
+#include "accumulator.h"
+#include "scenefile.h"
+#include "arena.h"
+#include "mesh.h"
 #include <float.h>
 
+//------------------------------------------------------------------------------
+/**
+    Everything a render thread owns for itself. Aligned to a cache line so
+    that two threads never write to the same one.
+*/
+struct alignas(64) ThreadContext
+{
+    // dimensions of the sample being traced
+    SampleStream samples;
+    // rays cast by this thread, camera rays and bounces
+    unsigned long long rayCount = 0;
+    // paths this thread ended by Russian roulette
+    unsigned long long rouletteCount = 0;
+};
+
 //------------------------------------------------------------------------------
 /**
 */
 class Raytracer
 {
 public:
-    Raytracer(unsigned w, unsigned h, std::vector<Color>& frameBuffer, unsigned rpp, unsigned bounces);
+    // threads = 0 uses one worker per hardware thread
+    Raytracer(unsigned w, unsigned h, std::vector<Color>& frameBuffer, unsigned rpp, unsigned bounces, unsigned threads = 0);
     ~Raytracer();
 
-    // start raytracing!
+    // start raytracing! Traces a whole frame and waits for it
     void Raytrace();
 
-    // add object to scene
-    void AddObject(Object* obj);
+    // start tracing a frame on the worker threads and return right away
+    void BeginRaytrace();
+
+    // wait for the frame started by BeginRaytrace, it then becomes frameBuffer.
+    // Returns false if Clear was called meanwhile, the frame is shown but
+    // accumulation starts over with the next one
+    bool EndRaytrace();
+
+    // construct an object of type T in the scene, returns its index
+    template<class T, class... ARGS> unsigned CreateObject(ARGS&&... args);
+
+    // get an object by the index returned from CreateObject
+    Object* GetObject(unsigned index) const;
+
+	// add material to materials list, returns its index
+	unsigned AddMaterial(Material const& mat);
+
+    // add a triangle mesh, see Mesh. It is only visible through instances, returns its index
+    unsigned AddMesh(std::vector<float> positions, std::vector<unsigned> indices);
+
+    // place a mesh returned from AddMesh in the scene, returns the object index of the instance
+    unsigned AddInstance(unsigned mesh, mat4 const& transform, unsigned material);
 
-	// add material to materials list
-	void AddMaterial(Material* mat);
+    // add a sphere to the SIMD sphere store. material is an index returned from AddMaterial
+    void AddSphere(float radius, vec3 center, unsigned material);
 
-    // single raycast, find object
-    static bool Raycast(Ray ray, vec3& hitPoint, vec3& hitNormal, Object*& hitObject, float& distance, std::vector<Object*> objects);
+    // make a mapped scene file the sphere store and material list, takes
+    // ownership. Spheres and materials added before are dropped from the
+    // scene, the sphere BVH stored in the file is used as it is
+    void AttachScene(SceneFile* file);
+
+    // rebuild the BVHs over spheres and objects that changed. Called automatically by Raytrace after objects were added
+    void UpdateAccelerationStructure();
+
+    // get a view of the scene for ray queries
+    SceneView GetSceneView() const;
+
+    // rays cast by all threads since the raytracer was created. Only
+    // meaningful while no frame is in flight
+    unsigned long long GetRayCount() const;
+
+    // paths ended by Russian roulette since the raytracer was created. Only
+    // meaningful while no frame is in flight
+    unsigned long long GetRouletteCount() const;
+
+    // single raycast, find closest object. Does not allocate
+    static bool Raycast(Ray const& ray, HitResult& hit, SceneView const& scene);
+
+    // raycast a packet of primary rays, finds the closest object for every ray in it
+    static void RaycastPacket(RayPacket& packet, HitResult hits[RayPacket::Size], SceneView const& scene);
 
     // set camera matrix
     void SetViewMatrix(mat4 val);
 
-    // clear screen
+    // replace the sampler, takes ownership. Not while a frame is in flight,
+    // and Clear before tracing the next one
+    void SetSampler(Sampler* sampler);
+
+    // start accumulating from scratch. Safe while a frame is in flight,
+    // which still completes and is shown, see EndRaytrace
     void Clear();
 
+    // tiles still being traced. Only meaningful while no frame is in flight
+    unsigned GetActiveTileCount() const;
+
+    // true once every tile has retired, see noiseThreshold
+    bool IsConverged() const;
+
     // update matrices. Called automatically after setting view matrix
     void UpdateMatrices();
 
     // trace a path and return intersection color
     // n is bounce depth
-    Color TracePath(Ray ray, unsigned n);
+    Color TracePath(Ray const& ray, unsigned n, ThreadContext& context);
+
+    // continue a path from a hit found at bounce depth n
+    Color Shade(Ray const& ray, HitResult const& hit, unsigned n, ThreadContext& context);
 
     // get the color of the skybox in a direction
     Color Skybox(vec3 direction);
 
+    // display ready sRGB output of the last completed frame. Its storage is
+    // swapped by EndRaytrace, so don't hold on to pointers into it
     std::vector<Color>& frameBuffer;
+    // running mean of every pixel over the frames traced since the last Clear
+    Accumulator accumulator;
+    // the workers read the settings from here to adaptiveMinFrames while
+    // they trace, change them only while no frame is in flight. Only
+    // noiseThreshold is copied by BeginRaytrace, like the view
+    // scales the linear color before tonemapping
+    float exposure = 1.0f;
+    Tonemap tonemap = TonemapClamp;
+    // scales the sky, lit scenes turn it down to let their lights show
+    float skyIntensity = 1.0f;
+    // sample a light at every diffuse bounce and weight it against the BSDF
+    // sample with MIS. Off, lights are only found by paths running into them
+    bool sampleLights = true;
     
     // rays per pixel
     unsigned rpp;
     // max number of bounces before termination
     unsigned bounces = 5;
+    // bounces every path takes before Russian roulette may end it. Above
+    // bounces, paths only end by escaping or at the bounce limit
+    unsigned rouletteDepth = 3;
+    // trace primary rays in 4x4 packets rather than one by one
+    bool packetTracing = true;
+    // a tile retires once every pixel in it has had adaptiveMinFrames and
+    // its Accumulator::GetError is below this. Retired tiles are not traced
+    // again until the next Clear, so the frames go to the noisy parts of
+    // the image. 0 traces every tile in every frame
+    float noiseThreshold = 0.0f;
+    unsigned adaptiveMinFrames = 16;
+    // frames traced since the last Clear. Sample indices continue from one
+    // frame to the next, so the samplers keep stratifying while accumulating
+    unsigned frameIndex = 0;
 
     // width of framebuffer
     const unsigned width;
@@ -64,33 +175,150 @@ public:
     const vec3 vertical = { 0.0, 2.0, 0.0 };
     const vec3 origin = { 0.0, 2.0, 10.0f };
 
-	// amount of pixels each thread should work per width
-	int widthPerThread;
-	// the remaining amount of pixels if they are not evenly dividable to the amount of threads
-	int leftOverPixels;
-
 	// amount of threads
-    const int threadCount = std::thread::hardware_concurrency();
-	// list of threads
-	std::vector<std::thread> threads;
+    const unsigned threadCount;
+	// worker threads, kept alive between frames
+	ThreadPool pool;
+	// per thread state, indexed by worker index
+	std::vector<ThreadContext> threadContexts;
+
+	// width and height of the tiles handed out to the threads
+	const unsigned tileSize = 16;
+	// hands out tiles to the threads, with work stealing
+	TileScheduler scheduler;
+	// where the numbers paths are built from come from, owned
+	Sampler* sampler;
+
+	// index of a tile in tileRetired
+	unsigned GetTileIndex(Tile const& tile) const;
+	// true if the tile has had enough frames and is below frameNoiseThreshold
+	bool IsTileConverged(Tile const& tile) const;
+
+	// output of the frame in flight, swapped with frameBuffer when it completes
+	std::vector<Color> backBuffer;
+	// per tile, row by row, non zero once it stopped being traced. Every tile
+	// is written by the one worker that traced it
+	std::vector<uint8_t> tileRetired;
+	// bumped by Clear, the accumulation of a frame started under an older
+	// generation is dropped once it completes
+	std::atomic<unsigned> generation{ 0 };
+	// snapshot taken by BeginRaytrace, this is what the workers read
+	unsigned frameGeneration = 0;
+	float frameNoiseThreshold = 0.0f;
+	mat4 frameView;
+	mat4 frameFrustum;
+	bool inFlight = false;
 
     // view matrix
     mat4 view;
     // Go from canonical to view frustum
     mat4 frustum;
 
-	std::vector<Material*> materials;
+	// every material, spheres and objects refer to them by index
+	MaterialStore materials;
+	// objects in creation order, their index is the one CreateObject returned
     std::vector<Object*> objects;
+    // meshes shared by the instances, in the arena like the objects
+    std::vector<Mesh*> meshes;
+    // memory the objects live in, next to each other and freed all at once
+    Arena objectArena;
+    // acceleration structure over objects
+    BVH bvh;
+    // packed spheres, and their acceleration structure
+    SphereStore spheres;
+    BVH sphereBvh;
+    // indices of the packed spheres that emit light, in sphere BVH order
+    std::vector<unsigned> lights;
+    // set when objects were added since the BVH was last built
+    bool bvhDirty = false;
+    // set when spheres were added since the sphere BVH was last built
+    bool sphereBvhDirty = false;
+    // scene file the spheres and materials are mapped from, owned
+    SceneFile* sceneFile = nullptr;
 	//Threading
+
+private:
+    // render a tile one ray at a time
+    void RenderTile(Tile const& tile, ThreadContext& context);
+    // render a tile in packets of primary rays
+    void RenderTilePackets(Tile const& tile, ThreadContext& context);
+    // write the resolved pixels of a tile to the framebuffer
+    void ResolveTile(Tile const& tile);
+    // direction through image coordinates x, y in pixels
+    vec3 GetCameraDirection(float x, float y) const;
+    // collect the emissive spheres, after they were sorted into BVH order
+    void UpdateLights();
 };
 
-inline void Raytracer::AddObject(Object* o)
+template<class T, class... ARGS> inline unsigned Raytracer::CreateObject(ARGS&&... args)
+{
+    this->objects.push_back(this->objectArena.New<T>(std::forward<ARGS>(args)...));
+    this->bvhDirty = true;
+    return (unsigned)this->objects.size() - 1;
+}
+inline unsigned Raytracer::AddMesh(std::vector<float> positions, std::vector<unsigned> indices)
+{
+    this->meshes.push_back(this->objectArena.New<Mesh>(std::move(positions), std::move(indices)));
+    return (unsigned)this->meshes.size() - 1;
+}
+inline unsigned Raytracer::AddInstance(unsigned mesh, mat4 const& transform, unsigned material)
+{
+    return this->CreateObject<MeshInstance>(this->meshes[mesh], transform, material);
+}
+inline Object* Raytracer::GetObject(unsigned index) const
+{
+    return this->objects[index];
+}
+inline unsigned Raytracer::AddMaterial(Material const& m)
+{
+	return this->materials.Add(m);
+}
+inline void Raytracer::AddSphere(float radius, vec3 center, unsigned material)
+{
+    this->spheres.Add(radius, center, material);
+    this->sphereBvhDirty = true;
+}
+inline void Raytracer::SetSampler(Sampler* sampler)
+{
+    delete this->sampler;
+    this->sampler = sampler;
+}
+
+inline SceneView Raytracer::GetSceneView() const
+{
+    SceneView scene;
+    scene.objects = this->objects.data();
+    scene.objectCount = this->objects.size();
+    scene.bvh = &this->bvh;
+    scene.spheres = &this->spheres;
+    scene.sphereBvh = &this->sphereBvh;
+    scene.materials = this->materials.materials;
+    scene.lights = this->lights.data();
+    scene.lightCount = (unsigned)this->lights.size();
+    return scene;
+}
+inline unsigned long long Raytracer::GetRayCount() const
+{
+    unsigned long long count = 0;
+    for (ThreadContext const& context : this->threadContexts)
+    {
+        count += context.rayCount;
+    }
+    return count;
+}
+inline unsigned Raytracer::GetTileIndex(Tile const& tile) const
 {
-    this->objects.push_back(o);
+    const unsigned tilesX = (this->width + this->tileSize - 1) / this->tileSize;
+    return (tile.y0 / this->tileSize) * tilesX + tile.x0 / this->tileSize;
 }
-inline void Raytracer::AddMaterial(Material* m)
+inline unsigned long long Raytracer::GetRouletteCount() const
 {
-	this->materials.push_back(m);
+    unsigned long long count = 0;
+    for (ThreadContext const& context : this->threadContexts)
+    {
+        count += context.rouletteCount;
+    }
+    return count;
 }
 inline void Raytracer::SetViewMatrix(mat4 val)
 {
@@ -0,0 +1,378 @@
+#include "sampler.h"
+#include "random.h"
+#include <math.h>
+#include <string.h>
+#include <float.h>
+
+namespace
+{
+
+// largest float below one
+const float OneMinusEpsilon = 0.99999994f;
+
+// direction numbers of the first four Sobol dimensions (Joe and Kuo)
+const unsigned SobolDirections[4][32] =
+{
+    {
+        0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000,
+        0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+        0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100,
+        0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001,
+    },
+    {
+        0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+        0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+        0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+        0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff,
+    },
+    {
+        0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000,
+        0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+        0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500,
+        0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555,
+    },
+    {
+        0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000,
+        0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000,
+        0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00,
+        0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093,
+    },
+};
+
+// one Halton base per dimension, enough for 7 bounces of SampleDimensionsPerBounce
+static const unsigned HaltonDimensions = 64;
+const unsigned Primes[HaltonDimensions] =
+{
+    2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+    59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+    137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+    227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline unsigned
+Hash(unsigned long long key)
+{
+    return (unsigned)(RandomMix(key) >> 32);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline unsigned
+HashPixel(unsigned x, unsigned y)
+{
+    return Hash(((unsigned long long)y << 32) | x);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline float
+ToFloat(unsigned bits)
+{
+    return float(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline unsigned
+ReverseBits(unsigned x)
+{
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+    x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Owen scrambles the bits of x from the top down, with the hash of
+    Laine and Karras as improved by Burley.
+*/
+inline unsigned
+NestedUniformScramble(unsigned x, unsigned seed)
+{
+    x = ReverseBits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return ReverseBits(x);
+}
+
+//------------------------------------------------------------------------------
+/**
+    The direction numbers picked by every possible byte of the index, xored
+    together. Scrambled indices use all 32 bits, and a loop over them with a
+    branch per bit costs more than the rest of the sampler together.
+*/
+struct SobolTables
+{
+    unsigned bytes[4][4][256];
+
+    SobolTables()
+    {
+        for (unsigned d = 0; d < 4; ++d)
+        {
+            for (unsigned b = 0; b < 4; ++b)
+            {
+                for (unsigned v = 0; v < 256; ++v)
+                {
+                    unsigned bits = 0;
+                    for (unsigned i = 0; i < 8; ++i)
+                    {
+                        if (v & (1u << i))
+                            bits ^= SobolDirections[d][b * 8 + i];
+                    }
+                    this->bytes[d][b][v] = bits;
+                }
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline unsigned
+Sobol(unsigned index, unsigned dimension)
+{
+    static const SobolTables tables;
+    unsigned const (&bytes)[4][256] = tables.bytes[dimension];
+    return bytes[0][index & 0xff] ^ bytes[1][(index >> 8) & 0xff] ^ bytes[2][(index >> 16) & 0xff] ^ bytes[3][index >> 24];
+}
+
+//------------------------------------------------------------------------------
+/**
+    One dimension of Burley's shuffled and scrambled 4D Sobol points. The
+    index is scrambled with the seed of the whole group, so all four
+    dimensions of a group stay stratified against each other.
+*/
+inline unsigned
+ScrambledSobol(unsigned index, unsigned dimension, unsigned seed)
+{
+    const unsigned group = dimension / 4;
+    const unsigned groupSeed = Hash(((unsigned long long)seed << 32) | group);
+    const unsigned shuffled = NestedUniformScramble(index, groupSeed);
+    return NestedUniformScramble(Sobol(shuffled, dimension % 4), Hash(((unsigned long long)groupSeed << 32) | dimension));
+}
+
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+float
+IndependentSampler::Get(unsigned x, unsigned y, unsigned sample, unsigned dimension) const
+{
+    RandomState state;
+    state.key = RandomMix(HashPixel(x, y) ^ ((unsigned long long)sample << 32));
+    state.counter = dimension;
+    return RandomFloat(state);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+float
+SobolSampler::Get(unsigned x, unsigned y, unsigned sample, unsigned dimension) const
+{
+    return ToFloat(ScrambledSobol(sample, dimension, HashPixel(x, y)));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+float
+HaltonSampler::Get(unsigned x, unsigned y, unsigned sample, unsigned dimension) const
+{
+    // reusing a base would tie the dimension to an earlier one, past the
+    // table the numbers are independent instead
+    if (dimension >= HaltonDimensions)
+    {
+        RandomState state;
+        state.key = RandomMix(HashPixel(x, y) ^ ((unsigned long long)sample << 32));
+        state.counter = dimension;
+        return RandomFloat(state);
+    }
+
+    const unsigned base = Primes[dimension];
+    const float invBase = 1.0f / base;
+
+    // radical inverse of the sample index
+    float value = 0.0f;
+    float scale = invBase;
+    for (unsigned i = sample; i != 0; i /= base)
+    {
+        value += (i % base) * scale;
+        scale *= invBase;
+    }
+
+    value += ToFloat(Hash(((unsigned long long)HashPixel(x, y) << 32) | dimension));
+    if (value >= 1.0f)
+        value -= 1.0f;
+    return fminf(value, OneMinusEpsilon);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Void and cluster (Ulichney 1993): spread a few points evenly, then rank
+    every pixel by the order in which it fills the largest remaining void.
+*/
+BlueNoiseSampler::BlueNoiseSampler() :
+    mask(MaskSize * MaskSize)
+{
+    const unsigned N = MaskSize;
+    const unsigned size = N * N;
+    const float sigma = 1.5f;
+
+    // gaussian of the toroidal distance to every offset
+    std::vector<float> kernel(size);
+    for (unsigned dy = 0; dy < N; ++dy)
+    {
+        for (unsigned dx = 0; dx < N; ++dx)
+        {
+            const float fx = float(dx < N - dx ? dx : N - dx);
+            const float fy = float(dy < N - dy ? dy : N - dy);
+            kernel[dy * N + dx] = expf(-(fx * fx + fy * fy) / (2.0f * sigma * sigma));
+        }
+    }
+
+    std::vector<float> energy(size, 0.0f);
+    std::vector<bool> set(size, false);
+    auto toggle = [&](unsigned p)
+    {
+        const float sign = set[p] ? -1.0f : 1.0f;
+        set[p] = !set[p];
+        const unsigned px = p % N;
+        const unsigned py = p / N;
+        for (unsigned q = 0; q < size; ++q)
+        {
+            const unsigned dx = (q % N - px) & (N - 1);
+            const unsigned dy = (q / N - py) & (N - 1);
+            energy[q] += sign * kernel[dy * N + dx];
+        }
+    };
+    // tightest cluster is the set pixel with the most energy, largest void the free one with the least
+    auto tightestCluster = [&]()
+    {
+        unsigned best = 0;
+        float bestEnergy = -FLT_MAX;
+        for (unsigned p = 0; p < size; ++p)
+        {
+            if (set[p] && energy[p] > bestEnergy)
+            {
+                best = p;
+                bestEnergy = energy[p];
+            }
+        }
+        return best;
+    };
+    auto largestVoid = [&]()
+    {
+        unsigned best = 0;
+        float bestEnergy = FLT_MAX;
+        for (unsigned p = 0; p < size; ++p)
+        {
+            if (!set[p] && energy[p] < bestEnergy)
+            {
+                best = p;
+                bestEnergy = energy[p];
+            }
+        }
+        return best;
+    };
+
+    // random initial pattern, the mask is the same on every run
+    RandomState random;
+    SeedRandom(random, 0x5eed);
+    const unsigned initialCount = size / 10;
+    for (unsigned placed = 0; placed < initialCount;)
+    {
+        const unsigned p = FastRandom(random) % size;
+        if (!set[p])
+        {
+            toggle(p);
+            placed++;
+        }
+    }
+
+    // move points from clusters into voids until that stops changing anything
+    for (unsigned i = 0; i < size; ++i)
+    {
+        const unsigned cluster = tightestCluster();
+        toggle(cluster);
+        const unsigned hole = largestVoid();
+        toggle(hole);
+        if (hole == cluster)
+            break;
+    }
+
+    std::vector<unsigned> rank(size);
+    const std::vector<float> initialEnergy = energy;
+    const std::vector<bool> initialSet = set;
+
+    // the initial points are ranked by taking away the tightest cluster first
+    for (unsigned r = initialCount; r-- > 0;)
+    {
+        const unsigned cluster = tightestCluster();
+        rank[cluster] = r;
+        toggle(cluster);
+    }
+
+    // the rest by filling the largest void first
+    energy = initialEnergy;
+    set = initialSet;
+    for (unsigned r = initialCount; r < size; ++r)
+    {
+        const unsigned hole = largestVoid();
+        rank[hole] = r;
+        toggle(hole);
+    }
+
+    for (unsigned p = 0; p < size; ++p)
+    {
+        this->mask[p] = (rank[p] + 0.5f) / size;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Every dimension reads the mask at its own offset, so that the shifts of
+    different dimensions are not correlated.
+*/
+float
+BlueNoiseSampler::Get(unsigned x, unsigned y, unsigned sample, unsigned dimension) const
+{
+    const unsigned offset = Hash(0xb1e0000000000000ull | dimension);
+    const unsigned mx = (x + offset) & (MaskSize - 1);
+    const unsigned my = (y + (offset >> 16)) & (MaskSize - 1);
+
+    float value = ToFloat(ScrambledSobol(sample, dimension, 0)) + this->mask[my * MaskSize + mx];
+    if (value >= 1.0f)
+        value -= 1.0f;
+    return fminf(value, OneMinusEpsilon);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Sampler*
+CreateSampler(const char* name)
+{
+    if (strcmp(name, "independent") == 0)
+        return new IndependentSampler();
+    if (strcmp(name, "sobol") == 0)
+        return new SobolSampler();
+    if (strcmp(name, "halton") == 0)
+        return new HaltonSampler();
+    if (strcmp(name, "bluenoise") == 0)
+        return new BlueNoiseSampler();
+    return nullptr;
+}
@@ -0,0 +1,141 @@
+#pragma once
+#include <vector>
+
+//------------------------------------------------------------------------------
+/**
+    Hands out the numbers a path is built from. A sample is addressed by the
+    pixel it belongs to, its index within that pixel and a dimension (one
+    per random decision along the path), so samplers are free to spread the
+    samples of a pixel much more evenly than independent random numbers do.
+*/
+class Sampler
+{
+public:
+    virtual ~Sampler() {}
+
+    // value of one dimension of one sample, in [0, 1)
+    virtual float Get(unsigned x, unsigned y, unsigned sample, unsigned dimension) const = 0;
+
+    // short name, used to pick a sampler by name
+    virtual const char* GetName() const = 0;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Plain independent random numbers, the baseline the others are measured against.
+*/
+class IndependentSampler : public Sampler
+{
+public:
+    float Get(unsigned x, unsigned y, unsigned sample, unsigned dimension) const override;
+    const char* GetName() const override { return "independent"; }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Owen scrambled Sobol points, using the hash based scrambling of Burley
+    (Practical Hash-based Owen Scrambling, JCGT 2020). Dimensions are taken
+    four at a time from the first four Sobol dimensions; every group of four
+    and every pixel gets its own scramble and index shuffle.
+*/
+class SobolSampler : public Sampler
+{
+public:
+    float Get(unsigned x, unsigned y, unsigned sample, unsigned dimension) const override;
+    const char* GetName() const override { return "sobol"; }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Halton points, one prime base per dimension, decorrelated between pixels
+    by a random toroidal shift. The first 64 dimensions get a base of their
+    own, the ones after that are independent random numbers like those of
+    IndependentSampler.
+*/
+class HaltonSampler : public Sampler
+{
+public:
+    float Get(unsigned x, unsigned y, unsigned sample, unsigned dimension) const override;
+    const char* GetName() const override { return "halton"; }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Every pixel traces the same scrambled Sobol sequence, shifted by a blue
+    noise mask (Georgiev and Fajardo, Blue-noise Dithered Sampling). What
+    error remains at low sample counts is then spread as high frequency
+    noise, which looks a lot smoother than white noise of the same power.
+*/
+class BlueNoiseSampler : public Sampler
+{
+public:
+    // builds the mask with void and cluster, which takes a few tens of milliseconds
+    BlueNoiseSampler();
+
+    float Get(unsigned x, unsigned y, unsigned sample, unsigned dimension) const override;
+    const char* GetName() const override { return "bluenoise"; }
+
+    // width and height of the tiled blue noise mask
+    static const unsigned MaskSize = 64;
+
+private:
+    std::vector<float> mask;
+};
+
+/// Create a sampler from its name, returns nullptr if there is no such sampler
+Sampler* CreateSampler(const char* name);
+
+/// Number of dimensions reserved for every bounce of a path. The BSDF takes
+/// the first three and Russian roulette the fourth, the light sample takes
+/// the second group of four
+static const unsigned SampleDimensionsPerBounce = 8;
+static const unsigned SampleDimensionRoulette = 3;
+static const unsigned SampleDimensionLight = 4;
+
+//------------------------------------------------------------------------------
+/**
+    The dimensions of one sample, consumed one after another.
+*/
+struct SampleStream
+{
+    Sampler const* sampler = nullptr;
+    unsigned x = 0;
+    unsigned y = 0;
+    unsigned sample = 0;
+    unsigned dimension = 0;
+};
+
+inline SampleStream BeginSample(Sampler const* sampler, unsigned x, unsigned y, unsigned sample)
+{
+    SampleStream stream;
+    stream.sampler = sampler;
+    stream.x = x;
+    stream.y = y;
+    stream.sample = sample;
+    return stream;
+}
+
+inline float NextSample(SampleStream& stream)
+{
+    return stream.sampler->Get(stream.x, stream.y, stream.sample, stream.dimension++);
+}
+
+// jump to the dimensions reserved for a bounce, so that bounce n always
+// draws from the same dimensions no matter how many were used before it
+inline void SetSampleBounce(SampleStream& stream, unsigned bounce)
+{
+    stream.dimension = bounce * SampleDimensionsPerBounce;
+}
+
+// the dimension of a bounce that decides Russian roulette
+inline float GetRouletteSample(SampleStream& stream, unsigned bounce)
+{
+    stream.dimension = bounce * SampleDimensionsPerBounce + SampleDimensionRoulette;
+    return NextSample(stream);
+}
+
+// jump to the dimensions of a bounce that pick a point on a light
+inline void SetSampleLight(SampleStream& stream, unsigned bounce)
+{
+    stream.dimension = bounce * SampleDimensionsPerBounce + SampleDimensionLight;
+}
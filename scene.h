@@ -0,0 +1,32 @@
+#pragma once
+#include <stddef.h>
+#include "object.h"
+#include "bvh.h"
+#include "spherestore.h"
+#include "material.h"
+
+//------------------------------------------------------------------------------
+/**
+    @struct SceneView
+
+    Non-owning view of everything a ray can hit. It is a handful of pointers,
+    so it is cheap to pass around, and querying it never allocates. The
+    Raytracer that handed it out must outlive it, and must not have objects
+    added while it is in use.
+*/
+struct SceneView
+{
+    Object* const* objects = nullptr;
+    size_t objectCount = 0;
+    BVH const* bvh = nullptr;
+
+    // spheres, ordered so that every leaf of sphereBvh is a contiguous range
+    SphereStore const* spheres = nullptr;
+    BVH const* sphereBvh = nullptr;
+    // materials referenced by the material indices of spheres and objects
+    Material const* materials = nullptr;
+
+    // the packed spheres with an emissive material, sampled for direct light
+    unsigned const* lights = nullptr;
+    unsigned lightCount = 0;
+};
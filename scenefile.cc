@@ -0,0 +1,473 @@
+#include "scenefile.h"
+#include "raytracer.h"
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// the binary form stores these exactly as they are in memory
+static_assert(sizeof(Material) == 24 && std::is_trivially_copyable<Material>::value, "Material layout changed, bump SceneFileVersion");
+static_assert(sizeof(BVHNode) == 32 && std::is_trivially_copyable<BVHNode>::value, "BVHNode layout changed, bump SceneFileVersion");
+
+static const char SceneFileMagic[8] = { 'T', 'R', 'A', 'Y', 'S', 'C', 'N', 'B' };
+static constexpr uint32_t SceneFileVersion = 2;
+// sections start on cache line boundaries, so that the SIMD loads never straddle more lines than they must
+static constexpr uint64_t SectionAlignment = 64;
+
+//------------------------------------------------------------------------------
+/**
+*/
+SceneFile::~SceneFile()
+{
+    this->Close();
+}
+
+//------------------------------------------------------------------------------
+/**
+    True if every material has a known type and every sphere refers to one
+    of them. The type is read as the integer that is stored, an enum holding
+    a value outside its enumerators is not something to test for
+*/
+static bool
+IsValidMaterials(Material const* materials, unsigned materialCount, unsigned const* indices, unsigned sphereCount)
+{
+    for (unsigned i = 0; i < materialCount; ++i)
+    {
+        std::underlying_type<MaterialType>::type type;
+        memcpy(&type, &materials[i].type, sizeof(type));
+        if ((unsigned)type > (unsigned)Emissive)
+            return false;
+    }
+    for (unsigned i = 0; i < sphereCount; ++i)
+    {
+        if (indices[i] >= materialCount)
+            return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Besides the header and the section bounds, everything the raytracer
+    indexes with is checked: the material index of every sphere, the
+    material types and the BVH nodes. That reads the material indices and
+    the nodes once, the positions and radii are used as they are and are
+    only paged in when rays get to them.
+*/
+bool
+SceneFile::Open(std::string const& path)
+{
+    this->Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(SceneFileHeader))
+    {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (view == nullptr)
+    {
+        if (mapping != nullptr)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    this->fileHandle = file;
+    this->mappingHandle = mapping;
+    this->data = (char const*)view;
+    this->size = (size_t)fileSize.QuadPart;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(SceneFileHeader))
+    {
+        close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive on its own
+    close(fd);
+    if (view == MAP_FAILED)
+        return false;
+    this->data = (char const*)view;
+    this->size = (size_t)info.st_size;
+#endif
+
+    SceneFileHeader const& header = this->GetHeader();
+    auto fits = [this](uint64_t offset, uint64_t count, uint64_t stride)
+    {
+        return offset % SectionAlignment == 0 && offset <= this->size && count <= (this->size - offset) / stride;
+    };
+    const uint64_t padded = (uint64_t)header.sphereCount + header.padding;
+    bool valid = memcmp(header.magic, SceneFileMagic, sizeof(SceneFileMagic)) == 0 &&
+        header.version == SceneFileVersion &&
+        header.padding >= SphereStore::BatchSize &&
+        fits(header.centerX, padded, sizeof(float)) &&
+        fits(header.centerY, padded, sizeof(float)) &&
+        fits(header.centerZ, padded, sizeof(float)) &&
+        fits(header.radius, padded, sizeof(float)) &&
+        fits(header.material, padded, sizeof(unsigned)) &&
+        fits(header.materials, header.materialCount, sizeof(Material)) &&
+        fits(header.nodes, header.nodeCount, sizeof(BVHNode)) &&
+        (header.sphereCount == 0 || header.nodeCount > 0);
+    // the nodes are traversed as they are, a bad child or leaf range would
+    // read outside the file
+    valid = valid && BVH::IsValid(reinterpret_cast<BVHNode const*>(this->data + header.nodes), header.nodeCount, header.sphereCount);
+    // same for a material index past the material list, or a type Shade has no case for
+    valid = valid && IsValidMaterials(this->GetMaterials(), header.materialCount, this->GetMaterialIndices(), header.sphereCount);
+    if (!valid)
+    {
+        this->Close();
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SceneFile::Close()
+{
+    if (this->data == nullptr)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(this->data);
+    CloseHandle(this->mappingHandle);
+    CloseHandle(this->fileHandle);
+    this->mappingHandle = nullptr;
+    this->fileHandle = nullptr;
+#else
+    munmap((void*)this->data, this->size);
+#endif
+    this->data = nullptr;
+    this->size = 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+IsBinarySceneFile(std::string const& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    char magic[sizeof(SceneFileMagic)];
+    const bool binary = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, SceneFileMagic, sizeof(magic)) == 0;
+    fclose(file);
+    return binary;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static bool
+ParseMaterialType(std::string const& name, MaterialType& type)
+{
+    if (name == "lambertian")
+        type = Lambertian;
+    else if (name == "dielectric")
+        type = Dielectric;
+    else if (name == "conductor")
+        type = Conductor;
+    else if (name == "emissive")
+        type = Emissive;
+    else
+        return false;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static const char*
+GetMaterialTypeName(MaterialType type)
+{
+    switch (type)
+    {
+    case Dielectric:
+        return "dielectric";
+    case Conductor:
+        return "conductor";
+    case Emissive:
+        return "emissive";
+    default:
+        return "lambertian";
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Materials have to be defined before the first sphere using them. A name
+    defined twice refers to the latest definition from then on.
+*/
+bool
+LoadTextScene(Raytracer& rt, std::string const& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        fprintf(stderr, "could not open scene '%s'\n", path.c_str());
+        return false;
+    }
+
+    std::unordered_map<std::string, unsigned> materialNames;
+    std::string line;
+    unsigned lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        lineNumber++;
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.resize(comment);
+
+        std::istringstream tokens(line);
+        std::string keyword;
+        if (!(tokens >> keyword))
+            continue;
+
+        bool valid = false;
+        if (keyword == "material")
+        {
+            std::string name, typeName;
+            Material material;
+            tokens >> name >> typeName >> material.color.r >> material.color.g >> material.color.b >> material.roughness;
+            if (tokens && ParseMaterialType(typeName, material.type))
+            {
+                // the refraction index is optional
+                float refractionIndex;
+                if (tokens >> refractionIndex)
+                    material.refractionIndex = refractionIndex;
+                materialNames[name] = rt.AddMaterial(material);
+                valid = true;
+            }
+        }
+        else if (keyword == "sphere")
+        {
+            float radius, x, y, z;
+            std::string materialName;
+            tokens >> radius >> x >> y >> z >> materialName;
+            auto material = materialNames.find(materialName);
+            if (tokens && material != materialNames.end())
+            {
+                rt.AddSphere(radius, { x, y, z }, material->second);
+                valid = true;
+            }
+        }
+        else if (keyword == "sky")
+        {
+            float intensity;
+            if (tokens >> intensity)
+            {
+                rt.skyIntensity = intensity;
+                valid = true;
+            }
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "%s:%u: could not parse '%s'\n", path.c_str(), lineNumber, line.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+LoadBinaryScene(Raytracer& rt, std::string const& path)
+{
+    SceneFile* file = new SceneFile();
+    if (!file->Open(path))
+    {
+        fprintf(stderr, "could not map scene '%s', or it is damaged or of another version\n", path.c_str());
+        delete file;
+        return false;
+    }
+    rt.AttachScene(file);
+    rt.skyIntensity = file->GetHeader().skyIntensity;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+LoadScene(Raytracer& rt, std::string const& path)
+{
+    if (IsBinarySceneFile(path))
+        return LoadBinaryScene(rt, path);
+    return LoadTextScene(rt, path);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Scene files only have room for spheres and materials. Rather than write
+    a file that silently lacks part of the scene, refuse to save it.
+*/
+static bool
+CanSaveScene(Raytracer const& rt, std::string const& path)
+{
+    if (rt.objects.empty() && rt.meshes.empty())
+        return true;
+    fprintf(stderr, "can't save '%s', scene files hold spheres and materials only, not the %u objects and %u meshes of this scene\n",
+        path.c_str(), (unsigned)rt.objects.size(), (unsigned)rt.meshes.size());
+    return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Floats are written with enough digits to read back bit exact.
+*/
+bool
+SaveTextScene(Raytracer& rt, std::string const& path)
+{
+    if (!CanSaveScene(rt, path))
+        return false;
+
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+        return false;
+
+    fprintf(file, "# trayracer scene\n");
+    fprintf(file, "# material <name> <lambertian|dielectric|conductor|emissive> <r> <g> <b> <roughness> [refraction index]\n");
+    fprintf(file, "# sphere <radius> <x> <y> <z> <material name>\n");
+    fprintf(file, "# sky <intensity>\n");
+    fprintf(file, "sky %.9g\n", rt.skyIntensity);
+    for (unsigned i = 0; i < rt.materials.Size(); ++i)
+    {
+        Material const& m = rt.materials[i];
+        fprintf(file, "material m%u %s %.9g %.9g %.9g %.9g %.9g\n", i, GetMaterialTypeName(m.type),
+            m.color.r, m.color.g, m.color.b, m.roughness, m.refractionIndex);
+    }
+
+    SphereStore const& spheres = rt.spheres;
+    for (unsigned i = 0; i < spheres.Size(); ++i)
+    {
+        fprintf(file, "sphere %.9g %.9g %.9g %.9g m%u\n", spheres.radius[i],
+            spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i], spheres.material[i]);
+    }
+
+    const bool written = ferror(file) == 0;
+    return fclose(file) == 0 && written;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Write bytes of data and pad with zeroes up to the next section boundary
+*/
+static void
+WriteSection(FILE* file, void const* data, uint64_t bytes)
+{
+    static const char zeroes[SectionAlignment] = {};
+    if (bytes > 0)
+        fwrite(data, 1, (size_t)bytes, file);
+    const uint64_t tail = bytes % SectionAlignment;
+    if (tail != 0)
+        fwrite(zeroes, 1, (size_t)(SectionAlignment - tail), file);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static uint64_t
+AlignSection(uint64_t bytes)
+{
+    return (bytes + SectionAlignment - 1) / SectionAlignment * SectionAlignment;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The sections follow the header in the order they are declared in it.
+*/
+bool
+SaveBinaryScene(Raytracer& rt, std::string const& path)
+{
+    if (!CanSaveScene(rt, path))
+        return false;
+
+    // the file stores the spheres in leaf order, with the BVH that goes with it
+    rt.UpdateAccelerationStructure();
+
+    SphereStore const& spheres = rt.spheres;
+    MaterialStore const& materials = rt.materials;
+    std::vector<BVHNode> const& nodes = rt.sphereBvh.nodes;
+
+    SceneFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SceneFileMagic, sizeof(SceneFileMagic));
+    header.version = SceneFileVersion;
+    header.sphereCount = spheres.Size();
+    header.padding = SphereStore::BatchSize;
+    header.materialCount = materials.Size();
+    header.nodeCount = (uint32_t)nodes.size();
+    header.skyIntensity = rt.skyIntensity;
+
+    const uint64_t arrayBytes = ((uint64_t)header.sphereCount + header.padding) * sizeof(float);
+    const uint64_t materialBytes = (uint64_t)header.materialCount * sizeof(Material);
+    const uint64_t nodeBytes = (uint64_t)header.nodeCount * sizeof(BVHNode);
+    header.centerX = AlignSection(sizeof(SceneFileHeader));
+    header.centerY = header.centerX + AlignSection(arrayBytes);
+    header.centerZ = header.centerY + AlignSection(arrayBytes);
+    header.radius = header.centerZ + AlignSection(arrayBytes);
+    header.material = header.radius + AlignSection(arrayBytes);
+    header.materials = header.material + AlignSection(arrayBytes);
+    header.nodes = header.materials + AlignSection(materialBytes);
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    WriteSection(file, &header, sizeof(header));
+    WriteSection(file, spheres.centerX, arrayBytes);
+    WriteSection(file, spheres.centerY, arrayBytes);
+    WriteSection(file, spheres.centerZ, arrayBytes);
+    WriteSection(file, spheres.radius, arrayBytes);
+    WriteSection(file, spheres.material, arrayBytes);
+    WriteSection(file, materials.materials, materialBytes);
+    WriteSection(file, nodes.data(), nodeBytes);
+
+    const bool written = ferror(file) == 0;
+    return fclose(file) == 0 && written;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+SaveScene(Raytracer& rt, std::string const& path)
+{
+    const size_t dot = path.rfind('.');
+    if (dot != std::string::npos && path.compare(dot, std::string::npos, ".trb") == 0)
+        return SaveBinaryScene(rt, path);
+    return SaveTextScene(rt, path);
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include "bvh.h"
+#include "material.h"
+
+class Raytracer;
+
+//------------------------------------------------------------------------------
+/**
+    Scene files come in two forms.
+
+    The text form is for authoring, one statement per line, # starts a comment:
+
+        material <name> <lambertian|dielectric|conductor|emissive> <r> <g> <b> <roughness> [refraction index]
+        sphere <radius> <x> <y> <z> <material name>
+        sky <intensity>
+
+    For emissive materials r g b is the radiance emitted, spheres made of
+    them are the lights of the scene.
+
+    The binary form is the sphere store, the material list and the sphere BVH
+    written out as they are in memory. It is mapped read only and used in
+    place, so loading it costs page faults rather than parsing. Every section
+    starts on a 64 byte boundary, and the file is only valid on machines with
+    the same byte order as the one that wrote it.
+*/
+
+/// Header at the start of a binary scene file
+struct SceneFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t sphereCount;
+    // zeroed entries after the last sphere in every sphere array
+    uint32_t padding;
+    uint32_t materialCount;
+    uint32_t nodeCount;
+    // Raytracer::skyIntensity the scene is meant to be seen with
+    float skyIntensity;
+    // byte offsets of the sections from the start of the file
+    uint64_t centerX;
+    uint64_t centerY;
+    uint64_t centerZ;
+    uint64_t radius;
+    uint64_t material;
+    uint64_t materials;
+    uint64_t nodes;
+};
+
+//------------------------------------------------------------------------------
+/**
+    A binary scene file mapped into memory. The raytracer keeps it open for
+    as long as its spheres and materials point into it.
+*/
+class SceneFile
+{
+public:
+    SceneFile() = default;
+    ~SceneFile();
+    SceneFile(SceneFile const&) = delete;
+    SceneFile& operator=(SceneFile const&) = delete;
+
+    // map a binary scene file and check its header and BVH nodes. Returns
+    // false if it can't be opened or isn't a scene file this build can use
+    bool Open(std::string const& path);
+
+    // unmap the file
+    void Close();
+
+    SceneFileHeader const& GetHeader() const;
+
+    // sphere arrays, sphereCount + padding entries each
+    float const* GetCenterX() const;
+    float const* GetCenterY() const;
+    float const* GetCenterZ() const;
+    float const* GetRadius() const;
+    unsigned const* GetMaterialIndices() const;
+    // materialCount materials
+    Material const* GetMaterials() const;
+    // nodeCount nodes of the sphere BVH, its leaves index the sphere arrays directly
+    BVHNode const* GetNodes() const;
+
+private:
+    template<class T> T const* Section(uint64_t offset) const;
+
+    char const* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+/// True if the file at path starts like a binary scene file
+bool IsBinarySceneFile(std::string const& path);
+
+/// Add the materials and spheres of a text scene file. Returns false and
+/// reports the offending line if the file can't be read or parsed
+bool LoadTextScene(Raytracer& rt, std::string const& path);
+
+/// Map a binary scene file and make it the raytracer's spheres and materials
+bool LoadBinaryScene(Raytracer& rt, std::string const& path);
+
+/// Load a scene file of either form, telling them apart by their contents
+bool LoadScene(Raytracer& rt, std::string const& path);
+
+/// Write the spheres and materials of the raytracer as text. Fails with a
+/// message if the scene has objects or meshes, which the format can't hold
+bool SaveTextScene(Raytracer& rt, std::string const& path);
+
+/// Write the spheres, materials and sphere BVH of the raytracer in binary
+/// form, building the BVH first if it is out of date. Fails like
+/// SaveTextScene if the scene has objects or meshes
+bool SaveBinaryScene(Raytracer& rt, std::string const& path);
+
+/// Save in binary form if path ends in .trb, as text otherwise
+bool SaveScene(Raytracer& rt, std::string const& path);
+
+inline SceneFileHeader const& SceneFile::GetHeader() const
+{
+    return *reinterpret_cast<SceneFileHeader const*>(this->data);
+}
+template<class T> inline T const* SceneFile::Section(uint64_t offset) const
+{
+    return reinterpret_cast<T const*>(this->data + offset);
+}
+inline float const* SceneFile::GetCenterX() const
+{
+    return this->Section<float>(this->GetHeader().centerX);
+}
+inline float const* SceneFile::GetCenterY() const
+{
+    return this->Section<float>(this->GetHeader().centerY);
+}
+inline float const* SceneFile::GetCenterZ() const
+{
+    return this->Section<float>(this->GetHeader().centerZ);
+}
+inline float const* SceneFile::GetRadius() const
+{
+    return this->Section<float>(this->GetHeader().radius);
+}
+inline unsigned const* SceneFile::GetMaterialIndices() const
+{
+    return this->Section<unsigned>(this->GetHeader().material);
+}
+inline Material const* SceneFile::GetMaterials() const
+{
+    return this->Section<Material>(this->GetHeader().materials);
+}
+inline BVHNode const* SceneFile::GetNodes() const
+{
+    return this->Section<BVHNode>(this->GetHeader().nodes);
+}
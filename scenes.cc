@@ -0,0 +1,234 @@
+#include "scenes.h"
+#include "raytracer.h"
+#include "material.h"
+#include "random.h"
+#include "scenefile.h"
+#include "mat4.h"
+#include <math.h>
+
+//------------------------------------------------------------------------------
+/**
+*/
+static void
+AddRandomSphere(Raytracer& rt, RandomState& random, MaterialType type, float span)
+{
+    Material mat;
+    mat.type = type;
+    float r = RandomFloat(random);
+    float g = RandomFloat(random);
+    float b = RandomFloat(random);
+    mat.color = { r,g,b };
+    mat.roughness = RandomFloat(random);
+    if (type == Dielectric)
+        mat.refractionIndex = 1.65;
+
+    // evaluated one by one, the order of the draws is part of the scene
+    float radius = RandomFloat(random) * 0.7f + 0.2f;
+    float x = RandomFloatNTP(random) * span;
+    float y = RandomFloat(random) * span + 0.2f;
+    float z = RandomFloatNTP(random) * span;
+    rt.AddSphere(radius, { x, y, z }, rt.AddMaterial(mat));
+}
+
+//------------------------------------------------------------------------------
+/**
+    The material type does not change how many numbers are drawn, so the
+    layout is the same whatever the types are
+*/
+static void
+AddSphereGroups(Raytracer& rt, unsigned groupCount, MaterialType const types[3])
+{
+    RandomState random;
+
+    Material mat;
+    mat.type = Lambertian;
+    mat.color = { 0.5,0.5,0.5 };
+    mat.roughness = 0.3;
+    rt.AddSphere(1000, { 0,-1000, -1 }, rt.AddMaterial(mat));
+
+    for (unsigned it = 0; it < groupCount; it++)
+    {
+        AddRandomSphere(rt, random, types[0], 10.0f);
+        AddRandomSphere(rt, random, types[1], 30.0f);
+        AddRandomSphere(rt, random, types[2], 25.0f);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+CreateSphereScene(Raytracer& rt, unsigned groupCount)
+{
+    const MaterialType types[3] = { Lambertian, Conductor, Dielectric };
+    AddSphereGroups(rt, groupCount, types);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+CreateUniformSphereScene(Raytracer& rt, unsigned groupCount, MaterialType type)
+{
+    const MaterialType types[3] = { type, type, type };
+    AddSphereGroups(rt, groupCount, types);
+}
+
+//------------------------------------------------------------------------------
+/**
+    The lights sit on a ring, so any count spreads them out evenly
+*/
+void
+CreateLightScene(Raytracer& rt, unsigned groupCount, unsigned lightCount)
+{
+    const MaterialType types[3] = { Lambertian, Conductor, Dielectric };
+    AddSphereGroups(rt, groupCount, types);
+    rt.skyIntensity = 0.02f;
+
+    Material light;
+    light.type = Emissive;
+    light.color = { 240.0f, 208.0f, 160.0f };
+    const unsigned material = rt.AddMaterial(light);
+    for (unsigned i = 0; i < lightCount; ++i)
+    {
+        const float angle = 2.0f * (float)MPI * (i + 0.5f) / lightCount;
+        rt.AddSphere(0.2f, { 7.0f * cosf(angle), 6.0f, 7.0f * sinf(angle) - 1.0f }, material);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Torus around the y axis, with rings segments around the axis and sides
+    segments around the tube
+*/
+static unsigned
+AddTorusMesh(Raytracer& rt, float majorRadius, float minorRadius, unsigned rings, unsigned sides)
+{
+    std::vector<float> positions;
+    std::vector<unsigned> indices;
+    positions.reserve(rings * sides * 3);
+    indices.reserve(rings * sides * 6);
+    for (unsigned i = 0; i < rings; ++i)
+    {
+        const float phi = 2.0f * (float)MPI * i / rings;
+        for (unsigned j = 0; j < sides; ++j)
+        {
+            const float theta = 2.0f * (float)MPI * j / sides;
+            const float r = majorRadius + minorRadius * cosf(theta);
+            positions.push_back(r * cosf(phi));
+            positions.push_back(minorRadius * sinf(theta));
+            positions.push_back(r * sinf(phi));
+        }
+    }
+    for (unsigned i = 0; i < rings; ++i)
+    {
+        for (unsigned j = 0; j < sides; ++j)
+        {
+            const unsigned a = i * sides + j;
+            const unsigned b = ((i + 1) % rings) * sides + j;
+            const unsigned c = ((i + 1) % rings) * sides + (j + 1) % sides;
+            const unsigned d = i * sides + (j + 1) % sides;
+            // counter clockwise seen from outside the tube
+            indices.insert(indices.end(), { a, d, c, a, c, b });
+        }
+    }
+    return rt.AddMesh(std::move(positions), std::move(indices));
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+CreateInstanceScene(Raytracer& rt, unsigned gridSize)
+{
+    RandomState random;
+
+    Material ground;
+    ground.type = Lambertian;
+    ground.color = { 0.5,0.5,0.5 };
+    ground.roughness = 0.3;
+    rt.AddSphere(1000, { 0,-1000, -1 }, rt.AddMaterial(ground));
+
+    const unsigned torus = AddTorusMesh(rt, 0.6f, 0.2f, 48, 24);
+
+    // a handful of materials shared by all instances
+    const unsigned paletteSize = 8;
+    unsigned palette[paletteSize];
+    for (unsigned i = 0; i < paletteSize; ++i)
+    {
+        Material mat;
+        mat.type = (MaterialType)(i % 3);
+        mat.color = { RandomFloat(random), RandomFloat(random), RandomFloat(random) };
+        mat.roughness = RandomFloat(random);
+        if (mat.type == Dielectric)
+            mat.refractionIndex = 1.65;
+        palette[i] = rt.AddMaterial(mat);
+    }
+
+    const float spacing = 2.0f;
+    for (unsigned z = 0; z < gridSize; ++z)
+    {
+        for (unsigned x = 0; x < gridSize; ++x)
+        {
+            const float scale = RandomFloat(random) * 0.6f + 0.6f;
+            mat4 transform = multiply(rotationy(RandomFloat(random) * 360.0f), rotationx(RandomFloat(random) * 360.0f));
+            transform.m00 *= scale; transform.m01 *= scale; transform.m02 *= scale;
+            transform.m10 *= scale; transform.m11 *= scale; transform.m12 *= scale;
+            transform.m20 *= scale; transform.m21 *= scale; transform.m22 *= scale;
+            transform.m30 = ((float)x - 0.5f * gridSize) * spacing;
+            transform.m31 = scale * 0.8f;
+            transform.m32 = 5.0f - (float)z * spacing;
+            rt.AddInstance(torus, transform, palette[FastRandom(random) % paletteSize]);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+CreateScene(Raytracer& rt, std::string const& name)
+{
+    if (name == "spheres")
+    {
+        CreateSphereScene(rt, 12);
+        return true;
+    }
+    if (name == "manyspheres")
+    {
+        CreateSphereScene(rt, 1000);
+        return true;
+    }
+    // sphere counts include the ground
+    if (name == "spheres10k")
+    {
+        CreateSphereScene(rt, 3333);
+        return true;
+    }
+    if (name == "spheres1m")
+    {
+        CreateSphereScene(rt, 333333);
+        return true;
+    }
+    if (name == "glass")
+    {
+        CreateUniformSphereScene(rt, 12, Dielectric);
+        return true;
+    }
+    if (name == "metal")
+    {
+        CreateUniformSphereScene(rt, 12, Conductor);
+        return true;
+    }
+    if (name == "lights")
+    {
+        CreateLightScene(rt, 12, 4);
+        return true;
+    }
+    if (name == "instances")
+    {
+        CreateInstanceScene(rt, 50);
+        return true;
+    }
+    return LoadScene(rt, name);
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+
+#include "material.h"
+
+class Raytracer;
+
+//------------------------------------------------------------------------------
+/**
+    Built in scenes, shared by the viewer and the command line renderer.
+*/
+
+/// A huge ground sphere with groups of a diffuse, a metal and a glass sphere
+/// scattered above it. The scene only depends on the count, never on what
+/// was rendered before.
+void CreateSphereScene(Raytracer& rt, unsigned groupCount);
+
+/// The layout of CreateSphereScene, with every sphere but the ground made of type
+void CreateUniformSphereScene(Raytracer& rt, unsigned groupCount, MaterialType type);
+
+/// The layout of CreateSphereScene at dusk: the sky is turned down and
+/// lightCount small, bright sphere lights hang above the groups
+void CreateLightScene(Raytracer& rt, unsigned groupCount, unsigned lightCount);
+
+/// The ground sphere with a grid of instances of one torus mesh on it, each
+/// turned and scaled differently. The mesh is stored once however large the grid
+void CreateInstanceScene(Raytracer& rt, unsigned gridSize);
+
+/// Create a built in scene by name, or load a scene file if there is no
+/// built in scene of that name. Returns false if neither works out
+bool CreateScene(Raytracer& rt, std::string const& name);
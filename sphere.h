@@ -8,14 +8,14 @@
 #include "ray.h"
 #include "material.h"
 
-// returns a random point on the surface of a unit sphere
-inline vec3 random_point_on_unit_sphere()
+// maps two numbers in [0, 1) to a point on the surface of a unit sphere
+inline vec3 random_point_on_unit_sphere(float u, float v)
 {
-    float x = RandomFloatNTP();
-    float y = RandomFloatNTP();
-    float z = RandomFloatNTP();
-    vec3 v( x, y, z );
-    return normalize(v);
+    // uniform in z and in the angle around it, which is uniform on the sphere
+    float z = 1.0f - 2.0f * u;
+    float r = sqrtf(fmaxf(0.0f, 1.0f - z * z));
+    float phi = 2.0f * 3.14159265f * v;
+    return vec3(r * cosf(phi), r * sinf(phi), z);
 }
 
 // a spherical object
@@ -24,9 +24,10 @@ class Sphere : public Object
 public:
     float radius;
     vec3 center;
-    Material const* const material;
+    // index returned from Raytracer::AddMaterial
+    unsigned material;
 
-    Sphere(float radius, vec3 center, Material const* const material) : 
+    Sphere(float radius, vec3 center, unsigned material) : 
         radius(radius),
         center(center),
         material(material)
@@ -39,21 +40,21 @@ public:
     
     }
 
-    Color GetColor()
+    AABB GetBounds() override
     {
-        return material->color;
+        vec3 r = vec3(this->radius, this->radius, this->radius);
+        return { this->center - r, this->center + r };
     }
 
-    Optional<HitResult> Intersect(Ray ray, float maxDist) override
+    bool Intersect(Ray const& ray, float maxDist, HitResult& hit) override
     {
-        HitResult hit;
         vec3 oc = ray.b - this->center;
         vec3 dir = ray.m;
         float b = dot(oc, dir);
     
         // early out if sphere is "behind" ray
         if (b > 0)
-            return Optional<HitResult>();
+            return false;
 
         float a = dot(dir, dir);
         float c = dot(oc, oc) - this->radius * this->radius;
@@ -63,7 +64,7 @@ public:
         {
             constexpr float minDist = 0.001f;
             float div = 1.0f / a;
-            float sqrtDisc = sqrt(discriminant);
+            float sqrtDisc = sqrtf(discriminant);
             float temp = (-b - sqrtDisc) * div;
             float temp2 = (-b + sqrtDisc) * div;
 
@@ -74,7 +75,8 @@ public:
                 hit.normal = (p - this->center) * (1.0f / this->radius);
                 hit.t = temp;
                 hit.object = this;
-                return Optional<HitResult>(hit);
+                hit.material = this->material;
+                return true;
             }
             if (temp2 < maxDist && temp2 > minDist)
             {
@@ -83,16 +85,12 @@ public:
                 hit.normal = (p - this->center) * (1.0f / this->radius);
                 hit.t = temp2;
                 hit.object = this;
-                return Optional<HitResult>(hit);
+                hit.material = this->material;
+                return true;
             }
         }
 
-        return Optional<HitResult>();
-    }
-
-    Ray ScatterRay(Ray ray, vec3 point, vec3 normal) override
-    {
-        return BSDF(this->material, ray, point, normal);
+        return false;
     }
 
 };
\ No newline at end of file
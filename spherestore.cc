@@ -0,0 +1,471 @@
+#include "spherestore.h"
+#include <float.h>
+#include <math.h>
+#include "profile.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SPHERESTORE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SPHERESTORE_AVX2
+#else
+#define SPHERESTORE_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// hits closer than this are ignored, so that a scattered ray does not hit the surface it left
+static constexpr float MinDist = 0.001f;
+
+//------------------------------------------------------------------------------
+/**
+    Ray data shared by all kernels, converted to float once per query
+*/
+struct SphereQuery
+{
+    float ox, oy, oz;
+    float dx, dy, dz;
+    // dot(dir, dir), and its reciprocal
+    float a, invA;
+};
+
+typedef bool (*SphereKernel)(SphereStore const& store, SphereQuery const& q, unsigned first, unsigned count, float& tMax, unsigned& hitIndex);
+
+//------------------------------------------------------------------------------
+/**
+    Reference implementation. Same test as Sphere::Intersect, with a more
+    precise discriminant
+*/
+static bool
+IntersectScalar(SphereStore const& store, SphereQuery const& q, unsigned first, unsigned count, float& tMax, unsigned& hitIndex)
+{
+    bool isHit = false;
+    for (unsigned i = first; i < first + count; ++i)
+    {
+        float ocx = q.ox - store.centerX[i];
+        float ocy = q.oy - store.centerY[i];
+        float ocz = q.oz - store.centerZ[i];
+        float b = ocx * q.dx + ocy * q.dy + ocz * q.dz;
+
+        // early out if sphere is "behind" ray
+        if (b > 0)
+            continue;
+
+        // b^2 - a*c cancels badly for far away spheres, so measure the
+        // distance from the center to the closest point on the ray instead
+        float s = b * q.invA;
+        float lx = ocx - q.dx * s;
+        float ly = ocy - q.dy * s;
+        float lz = ocz - q.dz * s;
+        float discriminant = q.a * (store.radius[i] * store.radius[i] - (lx * lx + ly * ly + lz * lz));
+        if (discriminant > 0)
+        {
+            float sqrtDisc = sqrtf(discriminant);
+            float t0 = (-b - sqrtDisc) * q.invA;
+            float t1 = (-b + sqrtDisc) * q.invA;
+            float t = (t0 < tMax && t0 > MinDist) ? t0 : ((t1 < tMax && t1 > MinDist) ? t1 : FLT_MAX);
+            if (t < tMax)
+            {
+                tMax = t;
+                hitIndex = i;
+                isHit = true;
+            }
+        }
+    }
+    return isHit;
+}
+
+#ifdef SPHERESTORE_X86
+//------------------------------------------------------------------------------
+/**
+    4 spheres per step, SSE2 only
+*/
+static bool
+IntersectSSE(SphereStore const& store, SphereQuery const& q, unsigned first, unsigned count, float& tMax, unsigned& hitIndex)
+{
+    const __m128 ox = _mm_set1_ps(q.ox);
+    const __m128 oy = _mm_set1_ps(q.oy);
+    const __m128 oz = _mm_set1_ps(q.oz);
+    const __m128 dx = _mm_set1_ps(q.dx);
+    const __m128 dy = _mm_set1_ps(q.dy);
+    const __m128 dz = _mm_set1_ps(q.dz);
+    const __m128 a = _mm_set1_ps(q.a);
+    const __m128 invA = _mm_set1_ps(q.invA);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 minDist = _mm_set1_ps(MinDist);
+    const __m128 noHit = _mm_set1_ps(FLT_MAX);
+    const __m128i end = _mm_set1_epi32((int)(first + count));
+    const __m128i step = _mm_set1_epi32(4);
+
+    __m128 bestT = _mm_set1_ps(tMax);
+    __m128i bestIndex = _mm_set1_epi32(-1);
+    __m128i index = _mm_add_epi32(_mm_set1_epi32((int)first), _mm_set_epi32(3, 2, 1, 0));
+
+    for (unsigned i = first; i < first + count; i += 4)
+    {
+        __m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(&store.centerX[i]));
+        __m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(&store.centerY[i]));
+        __m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(&store.centerZ[i]));
+        __m128 r = _mm_loadu_ps(&store.radius[i]);
+
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+        __m128 s = _mm_mul_ps(b, invA);
+        __m128 lx = _mm_sub_ps(ocx, _mm_mul_ps(dx, s));
+        __m128 ly = _mm_sub_ps(ocy, _mm_mul_ps(dy, s));
+        __m128 lz = _mm_sub_ps(ocz, _mm_mul_ps(dz, s));
+        __m128 l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz));
+        __m128 discriminant = _mm_mul_ps(a, _mm_sub_ps(_mm_mul_ps(r, r), l2));
+
+        __m128 valid = _mm_and_ps(_mm_cmple_ps(b, zero), _mm_cmpgt_ps(discriminant, zero));
+        valid = _mm_and_ps(valid, _mm_castsi128_ps(_mm_cmplt_epi32(index, end)));
+
+        __m128 sqrtDisc = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+        __m128 negB = _mm_sub_ps(zero, b);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(negB, sqrtDisc), invA);
+        __m128 t1 = _mm_mul_ps(_mm_add_ps(negB, sqrtDisc), invA);
+        __m128 use0 = _mm_and_ps(_mm_cmplt_ps(t0, bestT), _mm_cmpgt_ps(t0, minDist));
+        __m128 use1 = _mm_and_ps(_mm_cmplt_ps(t1, bestT), _mm_cmpgt_ps(t1, minDist));
+        __m128 t = _mm_or_ps(_mm_and_ps(use1, t1), _mm_andnot_ps(use1, noHit));
+        t = _mm_or_ps(_mm_and_ps(use0, t0), _mm_andnot_ps(use0, t));
+
+        __m128 closer = _mm_and_ps(valid, _mm_cmplt_ps(t, bestT));
+        bestT = _mm_or_ps(_mm_and_ps(closer, t), _mm_andnot_ps(closer, bestT));
+        __m128i closerI = _mm_castps_si128(closer);
+        bestIndex = _mm_or_si128(_mm_and_si128(closerI, index), _mm_andnot_si128(closerI, bestIndex));
+        index = _mm_add_epi32(index, step);
+    }
+
+    alignas(16) float t[4];
+    alignas(16) int idx[4];
+    _mm_store_ps(t, bestT);
+    _mm_store_si128((__m128i*)idx, bestIndex);
+    bool isHit = false;
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        if (idx[lane] >= 0 && t[lane] < tMax)
+        {
+            tMax = t[lane];
+            hitIndex = (unsigned)idx[lane];
+            isHit = true;
+        }
+    }
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+    8 spheres per step
+*/
+SPHERESTORE_AVX2 static bool
+IntersectAVX2(SphereStore const& store, SphereQuery const& q, unsigned first, unsigned count, float& tMax, unsigned& hitIndex)
+{
+    const __m256 ox = _mm256_set1_ps(q.ox);
+    const __m256 oy = _mm256_set1_ps(q.oy);
+    const __m256 oz = _mm256_set1_ps(q.oz);
+    const __m256 dx = _mm256_set1_ps(q.dx);
+    const __m256 dy = _mm256_set1_ps(q.dy);
+    const __m256 dz = _mm256_set1_ps(q.dz);
+    const __m256 a = _mm256_set1_ps(q.a);
+    const __m256 invA = _mm256_set1_ps(q.invA);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 minDist = _mm256_set1_ps(MinDist);
+    const __m256 noHit = _mm256_set1_ps(FLT_MAX);
+    const __m256i end = _mm256_set1_epi32((int)(first + count));
+    const __m256i step = _mm256_set1_epi32(8);
+
+    __m256 bestT = _mm256_set1_ps(tMax);
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+    __m256i index = _mm256_add_epi32(_mm256_set1_epi32((int)first), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+
+    for (unsigned i = first; i < first + count; i += 8)
+    {
+        __m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&store.centerX[i]));
+        __m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&store.centerY[i]));
+        __m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&store.centerZ[i]));
+        __m256 r = _mm256_loadu_ps(&store.radius[i]);
+
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+        __m256 s = _mm256_mul_ps(b, invA);
+        __m256 lx = _mm256_sub_ps(ocx, _mm256_mul_ps(dx, s));
+        __m256 ly = _mm256_sub_ps(ocy, _mm256_mul_ps(dy, s));
+        __m256 lz = _mm256_sub_ps(ocz, _mm256_mul_ps(dz, s));
+        __m256 l2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lx, lx), _mm256_mul_ps(ly, ly)), _mm256_mul_ps(lz, lz));
+        __m256 discriminant = _mm256_mul_ps(a, _mm256_sub_ps(_mm256_mul_ps(r, r), l2));
+
+        __m256 valid = _mm256_and_ps(_mm256_cmp_ps(b, zero, _CMP_LE_OQ), _mm256_cmp_ps(discriminant, zero, _CMP_GT_OQ));
+        valid = _mm256_and_ps(valid, _mm256_castsi256_ps(_mm256_cmpgt_epi32(end, index)));
+
+        __m256 sqrtDisc = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+        __m256 negB = _mm256_sub_ps(zero, b);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(negB, sqrtDisc), invA);
+        __m256 t1 = _mm256_mul_ps(_mm256_add_ps(negB, sqrtDisc), invA);
+        __m256 use0 = _mm256_and_ps(_mm256_cmp_ps(t0, bestT, _CMP_LT_OQ), _mm256_cmp_ps(t0, minDist, _CMP_GT_OQ));
+        __m256 use1 = _mm256_and_ps(_mm256_cmp_ps(t1, bestT, _CMP_LT_OQ), _mm256_cmp_ps(t1, minDist, _CMP_GT_OQ));
+        __m256 t = _mm256_blendv_ps(noHit, t1, use1);
+        t = _mm256_blendv_ps(t, t0, use0);
+
+        __m256 closer = _mm256_and_ps(valid, _mm256_cmp_ps(t, bestT, _CMP_LT_OQ));
+        bestT = _mm256_blendv_ps(bestT, t, closer);
+        bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(index), closer));
+        index = _mm256_add_epi32(index, step);
+    }
+
+    alignas(32) float t[8];
+    alignas(32) int idx[8];
+    _mm256_store_ps(t, bestT);
+    _mm256_store_si256((__m256i*)idx, bestIndex);
+    bool isHit = false;
+    for (int lane = 0; lane < 8; ++lane)
+    {
+        if (idx[lane] >= 0 && t[lane] < tMax)
+        {
+            tMax = t[lane];
+            hitIndex = (unsigned)idx[lane];
+            isHit = true;
+        }
+    }
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+    AVX2 needs both cpu support and the OS saving ymm registers
+*/
+static bool
+HasAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+//------------------------------------------------------------------------------
+/**
+*/
+struct KernelChoice
+{
+    SphereKernel kernel;
+    const char* name;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+static KernelChoice
+SelectKernel()
+{
+#ifdef SPHERESTORE_X86
+    if (HasAVX2())
+        return { IntersectAVX2, "avx2" };
+    return { IntersectSSE, "sse2" };
+#else
+    return { IntersectScalar, "scalar" };
+#endif
+}
+
+static KernelChoice Kernel = SelectKernel();
+
+//------------------------------------------------------------------------------
+/**
+*/
+const char*
+SphereStore::GetKernelName()
+{
+    return Kernel.name;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The scalar kernel is there on every cpu, the SIMD ones only where the
+    cpu runs them.
+*/
+bool
+SphereStore::SetKernel(std::string const& name)
+{
+    if (name == "scalar")
+        Kernel = { IntersectScalar, "scalar" };
+#ifdef SPHERESTORE_X86
+    else if (name == "sse2")
+        Kernel = { IntersectSSE, "sse2" };
+    else if (name == "avx2" && HasAVX2())
+        Kernel = { IntersectAVX2, "avx2" };
+#endif
+    else
+        return false;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+unsigned
+SphereStore::Add(float radius, vec3 center, unsigned material)
+{
+    this->MakeOwned();
+
+    const unsigned index = this->count;
+    this->ownedCenterX.resize(index);
+    this->ownedCenterY.resize(index);
+    this->ownedCenterZ.resize(index);
+    this->ownedRadius.resize(index);
+    this->ownedMaterial.resize(index);
+
+    this->ownedCenterX.push_back((float)center.x);
+    this->ownedCenterY.push_back((float)center.y);
+    this->ownedCenterZ.push_back((float)center.z);
+    this->ownedRadius.push_back(radius);
+    this->ownedMaterial.push_back(material);
+    this->count++;
+
+    this->Pad();
+    return index;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SphereStore::Clear()
+{
+    this->ownedCenterX.clear();
+    this->ownedCenterY.clear();
+    this->ownedCenterZ.clear();
+    this->ownedRadius.clear();
+    this->ownedMaterial.clear();
+    this->count = 0;
+    this->view = false;
+    this->UpdatePointers();
+}
+
+//------------------------------------------------------------------------------
+/**
+    The arrays must hold count + BatchSize entries, the ones past count zeroed.
+*/
+void
+SphereStore::SetView(float const* centerX, float const* centerY, float const* centerZ, float const* radius, unsigned const* material, unsigned count)
+{
+    this->Clear();
+    this->centerX = centerX;
+    this->centerY = centerY;
+    this->centerZ = centerZ;
+    this->radius = radius;
+    this->material = material;
+    this->count = count;
+    this->view = true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SphereStore::MakeOwned()
+{
+    if (!this->view)
+        return;
+
+    const size_t padded = this->count + BatchSize;
+    this->ownedCenterX.assign(this->centerX, this->centerX + padded);
+    this->ownedCenterY.assign(this->centerY, this->centerY + padded);
+    this->ownedCenterZ.assign(this->centerZ, this->centerZ + padded);
+    this->ownedRadius.assign(this->radius, this->radius + padded);
+    this->ownedMaterial.assign(this->material, this->material + padded);
+    this->view = false;
+    this->UpdatePointers();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SphereStore::UpdatePointers()
+{
+    this->centerX = this->ownedCenterX.data();
+    this->centerY = this->ownedCenterY.data();
+    this->centerZ = this->ownedCenterZ.data();
+    this->radius = this->ownedRadius.data();
+    this->material = this->ownedMaterial.data();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SphereStore::Pad()
+{
+    const size_t padded = this->count + BatchSize;
+    this->ownedCenterX.resize(padded, 0.0f);
+    this->ownedCenterY.resize(padded, 0.0f);
+    this->ownedCenterZ.resize(padded, 0.0f);
+    this->ownedRadius.resize(padded, 0.0f);
+    this->ownedMaterial.resize(padded, 0);
+    this->UpdatePointers();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+AABB
+SphereStore::GetBounds(unsigned index) const
+{
+    const float r = this->radius[index];
+    AABB box;
+    box.min = vec3(this->centerX[index] - r, this->centerY[index] - r, this->centerZ[index] - r);
+    box.max = vec3(this->centerX[index] + r, this->centerY[index] + r, this->centerZ[index] + r);
+    return box;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SphereStore::Reorder(std::vector<unsigned> const& order)
+{
+    this->MakeOwned();
+
+    auto shuffle = [&order, this](auto& values)
+    {
+        auto copy = values;
+        for (unsigned i = 0; i < this->count; ++i)
+        {
+            values[i] = copy[order[i]];
+        }
+    };
+    shuffle(this->ownedCenterX);
+    shuffle(this->ownedCenterY);
+    shuffle(this->ownedCenterZ);
+    shuffle(this->ownedRadius);
+    shuffle(this->ownedMaterial);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+SphereStore::Intersect(Ray const& ray, unsigned first, unsigned count, float& tMax, unsigned& hitIndex) const
+{
+    SphereQuery q;
+    q.ox = (float)ray.b.x;
+    q.oy = (float)ray.b.y;
+    q.oz = (float)ray.b.z;
+    q.dx = (float)ray.m.x;
+    q.dy = (float)ray.m.y;
+    q.dz = (float)ray.m.z;
+    q.a = q.dx * q.dx + q.dy * q.dy + q.dz * q.dz;
+    q.invA = 1.0f / q.a;
+    PROFILE_COUNT(CounterSphereTests, count);
+    return Kernel.kernel(*this, q, first, count, tMax, hitIndex);
+}
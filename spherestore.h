@@ -0,0 +1,97 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+
+//------------------------------------------------------------------------------
+/**
+    Spheres stored as structure of arrays, so that a batch of them can be
+    intersected with one SIMD instruction per step instead of one virtual
+    call each.
+
+    Every array is padded with zeroed entries past the end, so the kernels can
+    always load a full vector; lanes past the end of a range are masked off.
+
+    The arrays are either owned by the store, or a read only view of memory
+    owned by someone else, such as a mapped scene file. A view is copied into
+    the store's own arrays the first time it is modified.
+*/
+class SphereStore
+{
+public:
+    // the widest batch any kernel loads at once
+    static constexpr unsigned BatchSize = 8;
+
+    SphereStore() = default;
+    // the public arrays may point into the store itself
+    SphereStore(SphereStore const&) = delete;
+    SphereStore& operator=(SphereStore const&) = delete;
+
+    // add a sphere, returns its index
+    unsigned Add(float radius, vec3 center, unsigned material);
+
+    // remove all spheres
+    void Clear();
+
+    // use count spheres from external arrays, each padded like the store's
+    // own. The memory must outlive the view
+    void SetView(float const* centerX, float const* centerY, float const* centerZ, float const* radius, unsigned const* material, unsigned count);
+
+    // true if the arrays point to external memory
+    bool IsView() const;
+
+    // number of spheres
+    unsigned Size() const;
+
+    // bounding box of a single sphere
+    AABB GetBounds(unsigned index) const;
+
+    // shuffle spheres so that the sphere at position i becomes order[i]
+    void Reorder(std::vector<unsigned> const& order);
+
+    // find the closest sphere in [first, first + count) that the ray hits nearer than tMax.
+    // Returns true and shrinks tMax on a hit, with the sphere index in hitIndex
+    bool Intersect(Ray const& ray, unsigned first, unsigned count, float& tMax, unsigned& hitIndex) const;
+
+    // name of the intersection kernel picked for this cpu
+    static const char* GetKernelName();
+
+    // use the kernel called scalar, sse2 or avx2 instead, to compare them.
+    // Returns false if it is unknown or this cpu can't run it. Not while
+    // a frame is in flight
+    static bool SetKernel(std::string const& name);
+
+    float const* centerX = nullptr;
+    float const* centerY = nullptr;
+    float const* centerZ = nullptr;
+    float const* radius = nullptr;
+    // index into the material list of the scene
+    unsigned const* material = nullptr;
+
+private:
+    // keep BatchSize zeroed entries after the last sphere
+    void Pad();
+    // copy a view into the owned arrays
+    void MakeOwned();
+    // point the public arrays at the owned ones
+    void UpdatePointers();
+
+    std::vector<float> ownedCenterX;
+    std::vector<float> ownedCenterY;
+    std::vector<float> ownedCenterZ;
+    std::vector<float> ownedRadius;
+    std::vector<unsigned> ownedMaterial;
+    unsigned count = 0;
+    bool view = false;
+};
+
+inline unsigned SphereStore::Size() const
+{
+    return this->count;
+}
+inline bool SphereStore::IsView() const
+{
+    return this->view;
+}
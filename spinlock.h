@@ -1,5 +1,6 @@
 #pragma once
 #include <atomic>
+#include <thread>
 #include <iostream>
 using std::atomic;
 using std::cout;
@@ -11,20 +12,19 @@ class Spinlock
 public:
 	static bool testAndSet(atomic<int>& flag)
 	{
-		int lockResult = flag.fetch_add(1, std::memory_order_acquire);
-		//check if the old value was 0 which means the lock was free
-		return lockResult == 0;
+		int lockResult = flag.exchange(1, std::memory_order_acquire);
+		//check if the old value was 1 which means the lock was already taken
+		return lockResult == 1;
 	}
 	void lock()
 	{
 		while (testAndSet(lockFlag))
 		{
-#ifdef _WIN32 
-#pragma pause
-#else
-			// Optional: Short sleep (use with caution)
-			std::this_thread::yield();
-#endif
+			// wait on a plain load so we don't hammer the cache line with writes
+			while (lockFlag.load(std::memory_order_relaxed) == 1)
+			{
+				std::this_thread::yield();
+			}
 		}
 	}
 	void unlock()
@@ -33,4 +33,4 @@ public:
 	}
 private:
 	atomic<int> lockFlag{ 0 };
-};
\ No newline at end of file
+};
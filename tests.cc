@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include "raytracer.h"
+#include "scenes.h"
+
+//------------------------------------------------------------------------------
+/**
+    Every allocation of the process goes through here, so a test can tell
+    whether the code it ran allocated.
+*/
+static std::atomic<unsigned long long> allocationCount{ 0 };
+
+void*
+operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void*
+operator new(size_t size, std::align_val_t align)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    const size_t alignment = (size_t)align;
+    // aligned_alloc wants a multiple of the alignment
+    if (void* p = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+
+//------------------------------------------------------------------------------
+/**
+    The scenes the tests render, one of every kind of geometry and light
+*/
+static const char* const TestScenes[] = { "spheres", "lights", "instances" };
+
+//------------------------------------------------------------------------------
+/**
+    Small enough to run in a second, with tiles along the right and bottom
+    edge that are cut off.
+*/
+static const unsigned TestWidth = 72;
+static const unsigned TestHeight = 40;
+
+//------------------------------------------------------------------------------
+/**
+*/
+static bool
+SetupScene(Raytracer& rt, std::string const& scene)
+{
+    if (!CreateScene(rt, scene))
+    {
+        fprintf(stderr, "unknown scene %s\n", scene.c_str());
+        return false;
+    }
+    rt.UpdateAccelerationStructure();
+
+    // same starting camera as the viewer
+    mat4 cameraTransform = multiply(rotationy(0), rotationx(0));
+    cameraTransform.m30 = 0.0f;
+    cameraTransform.m31 = 1.0f;
+    cameraTransform.m32 = 10.0f;
+    rt.SetViewMatrix(cameraTransform);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Once the scene is built and the first frame has woken the workers up,
+    tracing must not touch the heap: a frame of paths, primary rays in
+    packets or one by one, allocates nothing.
+*/
+static bool
+TestAllocations()
+{
+    bool passed = true;
+    for (const char* scene : TestScenes)
+    {
+        for (bool packets : { true, false })
+        {
+            std::vector<Color> framebuffer(TestWidth * TestHeight);
+            Raytracer rt(TestWidth, TestHeight, framebuffer, 1, 5, 2);
+            rt.packetTracing = packets;
+            if (!SetupScene(rt, scene))
+                return false;
+            rt.Raytrace();
+
+            const unsigned long long raysBefore = rt.GetRayCount();
+            const unsigned long long before = allocationCount.load();
+            rt.Raytrace();
+            rt.Raytrace();
+            const unsigned long long allocations = allocationCount.load() - before;
+            const unsigned long long rays = rt.GetRayCount() - raysBefore;
+
+            printf("allocations %-10s %-7s %llu in %llu rays\n", scene, packets ? "packets" : "scalar", allocations, rays);
+            if (allocations != 0)
+                passed = false;
+        }
+    }
+    return passed;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Every pixel sample is seeded from the pixel and the sample index alone,
+    so the image must not depend on how many threads traced it, in which
+    order the tiles were stolen, or whether the primary rays went in
+    packets. The running means are compared bit for bit.
+*/
+static bool
+TestDeterminism()
+{
+    bool passed = true;
+    for (const char* scene : TestScenes)
+    {
+        std::vector<Color> reference;
+        for (unsigned threads : { 1u, 3u, 4u })
+        {
+            for (bool packets : { false, true })
+            {
+                std::vector<Color> framebuffer(TestWidth * TestHeight);
+                Raytracer rt(TestWidth, TestHeight, framebuffer, 2, 5, threads);
+                rt.packetTracing = packets;
+                if (!SetupScene(rt, scene))
+                    return false;
+                for (unsigned frame = 0; frame < 3; ++frame)
+                {
+                    rt.Raytrace();
+                }
+
+                std::vector<Color> means;
+                rt.accumulator.CopyMeans(means);
+                if (reference.empty())
+                {
+                    reference = means;
+                    continue;
+                }
+
+                const bool same = means.size() == reference.size() &&
+                    memcmp(means.data(), reference.data(), means.size() * sizeof(Color)) == 0;
+                printf("determinism %-10s %u threads %-7s %s\n", scene, threads, packets ? "packets" : "scalar", same ? "same" : "DIFFERENT");
+                if (!same)
+                    passed = false;
+            }
+        }
+    }
+    return passed;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The viewer clears on every camera move, while a frame is in flight.
+    That frame must still reach the screen, only the accumulation behind it
+    is dropped.
+*/
+static bool
+TestClearInFlight()
+{
+    std::vector<Color> framebuffer(TestWidth * TestHeight);
+    Raytracer rt(TestWidth, TestHeight, framebuffer, 1, 5, 2);
+    if (!SetupScene(rt, "spheres"))
+        return false;
+    rt.Raytrace();
+    rt.Raytrace();
+
+    std::vector<Color> shown = framebuffer;
+    rt.BeginRaytrace();
+    rt.Clear();
+    const bool kept = rt.EndRaytrace();
+
+    const bool presented = memcmp(shown.data(), rt.frameBuffer.data(), shown.size() * sizeof(Color)) != 0;
+    const bool cleared = !kept && rt.frameIndex == 0 && rt.accumulator.GetTotalCount() == 0;
+    printf("clear in flight: frame %s, accumulation %s\n", presented ? "shown" : "NOT SHOWN", cleared ? "cleared" : "NOT CLEARED");
+    return presented && cleared;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Copy of a saved scene file with one value changed at byte offset
+*/
+static bool
+WritePatchedFile(std::string const& from, std::string const& to, uint64_t offset, uint32_t value)
+{
+    FILE* file = fopen(from.c_str(), "rb");
+    if (file == nullptr)
+        return false;
+    std::vector<char> bytes;
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        bytes.insert(bytes.end(), buffer, buffer + read);
+    }
+    fclose(file);
+    if (offset + sizeof(value) > bytes.size())
+        return false;
+    memcpy(bytes.data() + offset, &value, sizeof(value));
+
+    file = fopen(to.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    const bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && written;
+}
+
+//------------------------------------------------------------------------------
+/**
+    A binary scene is used straight from the mapping, so SceneFile::Open
+    has to turn away files whose spheres refer to a material that isn't
+    there, or whose materials have a type that doesn't exist.
+*/
+static bool
+TestSceneFileValidation()
+{
+    const std::string path = "trayracer-tests.trb";
+    const std::string damaged = "trayracer-tests-damaged.trb";
+    {
+        std::vector<Color> framebuffer(TestWidth * TestHeight);
+        Raytracer rt(TestWidth, TestHeight, framebuffer, 1, 5, 1);
+        if (!CreateScene(rt, "lights") || !SaveBinaryScene(rt, path))
+            return false;
+    }
+
+    SceneFile file;
+    if (!file.Open(path))
+    {
+        printf("scene file: the undamaged file does not open\n");
+        return false;
+    }
+    const SceneFileHeader header = file.GetHeader();
+    file.Close();
+
+    struct Damage
+    {
+        const char* name;
+        uint64_t offset;
+        uint32_t value;
+    };
+    const Damage damages[] =
+    {
+        { "material index past the list", header.material + 5 * sizeof(unsigned), header.materialCount },
+        { "huge material index", header.material, 0xffffffffu },
+        { "unknown material type", header.materials + 2 * sizeof(Material) + offsetof(Material, type), Emissive + 1 },
+    };
+
+    bool passed = true;
+    for (Damage const& damage : damages)
+    {
+        if (!WritePatchedFile(path, damaged, damage.offset, damage.value))
+            return false;
+        SceneFile damagedFile;
+        const bool rejected = !damagedFile.Open(damaged);
+        printf("scene file: %-30s %s\n", damage.name, rejected ? "rejected" : "ACCEPTED");
+        passed = passed && rejected;
+    }
+    remove(path.c_str());
+    remove(damaged.c_str());
+    return passed;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Runs the test named on the command line, or all of them. Exits with 0
+    only if every test that ran passed, which is what CTest looks at.
+*/
+int
+main(int argc, char* argv[])
+{
+    struct Test
+    {
+        const char* name;
+        bool (*run)();
+    };
+    const Test tests[] =
+    {
+        { "allocations", TestAllocations },
+        { "determinism", TestDeterminism },
+        { "clear", TestClearInFlight },
+        { "scenefile", TestSceneFileValidation },
+    };
+
+    const char* only = argc > 1 ? argv[1] : nullptr;
+    bool passed = true;
+    bool found = false;
+    for (Test const& test : tests)
+    {
+        if (only != nullptr && strcmp(only, test.name) != 0)
+            continue;
+        found = true;
+        const bool result = test.run();
+        printf("%s: %s\n", test.name, result ? "passed" : "FAILED");
+        passed = passed && result;
+    }
+
+    if (!found)
+    {
+        fprintf(stderr, "no test named %s\n", only);
+        return 1;
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+#include "threadpool.h"
+#include <assert.h>
+
+//------------------------------------------------------------------------------
+/**
+*/
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    if (threadCount == 0)
+        threadCount = 1;
+
+    this->threads.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; ++i)
+    {
+        this->threads.emplace_back(&ThreadPool::Work, this, i);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+ThreadPool::~ThreadPool()
+{
+    this->Wait();
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->quit = true;
+    }
+    this->wake.notify_all();
+    for (auto& thread : this->threads)
+    {
+        thread.join();
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ThreadPool::Dispatch(std::function<void(unsigned)> const& job)
+{
+    {
+        std::lock_guard<std::mutex> guard(this->mutex);
+        assert(this->busy == 0 && "<ThreadPool> previous job still running");
+        this->job = job;
+        this->busy = (unsigned)this->threads.size();
+        this->generation++;
+    }
+    this->wake.notify_all();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> guard(this->mutex);
+    this->done.wait(guard, [this]() { return this->busy == 0; });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ThreadPool::Work(unsigned index)
+{
+    unsigned long long seen = 0;
+    std::unique_lock<std::mutex> guard(this->mutex);
+    while (true)
+    {
+        this->wake.wait(guard, [this, seen]() { return this->quit || this->generation != seen; });
+        if (this->quit)
+            return;
+
+        seen = this->generation;
+        guard.unlock();
+        this->job(index);
+        guard.lock();
+
+        if (--this->busy == 0)
+        {
+            this->done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//------------------------------------------------------------------------------
+/**
+    A fixed set of worker threads that live as long as the pool does.
+
+    Work is handed out one frame at a time: Dispatch runs the same job on
+    every worker (each gets its own worker index) and returns immediately,
+    Wait blocks until all workers are done with it.
+*/
+class ThreadPool
+{
+public:
+    ThreadPool(unsigned threadCount);
+    ~ThreadPool();
+
+    // run job on every worker thread. The previous job must have been waited for
+    void Dispatch(std::function<void(unsigned)> const& job);
+
+    // block until every worker has finished the dispatched job
+    void Wait();
+
+    // number of worker threads
+    unsigned GetThreadCount() const;
+
+private:
+    // worker thread main loop
+    void Work(unsigned index);
+
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    // signalled when a new job is dispatched, or when the pool shuts down
+    std::condition_variable wake;
+    // signalled when the last worker finishes its job
+    std::condition_variable done;
+
+    std::function<void(unsigned)> job;
+    // bumped on every dispatch so that workers can tell a new job from a spurious wakeup
+    unsigned long long generation = 0;
+    // workers still running the current job
+    unsigned busy = 0;
+    bool quit = false;
+};
+
+inline unsigned ThreadPool::GetThreadCount() const
+{
+    return (unsigned)this->threads.size();
+}
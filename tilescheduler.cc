@@ -0,0 +1,88 @@
+#include "tilescheduler.h"
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+/**
+*/
+TileScheduler::TileScheduler(unsigned workerCount, unsigned tileSize) :
+    queues(new WorkQueue[std::max(workerCount, 1u)]),
+    workerCount(std::max(workerCount, 1u)),
+    tileSize(std::max(tileSize, 1u))
+{
+}
+
+//------------------------------------------------------------------------------
+/**
+    Must not be called while workers are fetching tiles.
+*/
+void
+TileScheduler::Reset(unsigned width, unsigned height)
+{
+    for (unsigned i = 0; i < this->workerCount; ++i)
+    {
+        this->queues[i].tiles.clear();
+    }
+
+    // deal the tiles out round robin, so that neighbouring tiles (which
+    // usually cost about the same) end up on different workers
+    unsigned worker = 0;
+    this->tileCount = 0;
+    for (unsigned y = 0; y < height; y += this->tileSize)
+    {
+        for (unsigned x = 0; x < width; x += this->tileSize)
+        {
+            Tile tile;
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = std::min(x + this->tileSize, width);
+            tile.y1 = std::min(y + this->tileSize, height);
+            this->queues[worker].tiles.push_back(tile);
+            worker = (worker + 1) % this->workerCount;
+            this->tileCount++;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+TileScheduler::Next(unsigned worker, Tile& tile)
+{
+    WorkQueue& own = this->queues[worker % this->workerCount];
+    own.lock.lock();
+    if (!own.tiles.empty())
+    {
+        tile = own.tiles.back();
+        own.tiles.pop_back();
+        own.lock.unlock();
+        return true;
+    }
+    own.lock.unlock();
+
+    return this->Steal(worker, tile);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Tiles are never added during a frame, so once every deque has been seen
+    empty there is nothing left to steal.
+*/
+bool
+TileScheduler::Steal(unsigned thief, Tile& tile)
+{
+    for (unsigned i = 1; i < this->workerCount; ++i)
+    {
+        WorkQueue& victim = this->queues[(thief + i) % this->workerCount];
+        victim.lock.lock();
+        if (!victim.tiles.empty())
+        {
+            tile = victim.tiles.front();
+            victim.tiles.pop_front();
+            victim.lock.unlock();
+            return true;
+        }
+        victim.lock.unlock();
+    }
+    return false;
+}
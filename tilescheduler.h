@@ -0,0 +1,60 @@
+#pragma once
+#include <deque>
+#include <memory>
+#include "spinlock.h"
+
+//------------------------------------------------------------------------------
+/**
+    A rectangular region of the framebuffer, covering [x0, x1) x [y0, y1)
+*/
+struct Tile
+{
+    unsigned x0 = 0;
+    unsigned y0 = 0;
+    unsigned x1 = 0;
+    unsigned y1 = 0;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Splits the framebuffer into fixed size tiles and hands them out to workers.
+
+    Every worker owns a deque of tiles which it pops from the back. When a
+    worker runs dry it steals from the front of the other workers' deques, so
+    a worker stuck in an expensive part of the image gets helped out instead
+    of holding up the whole frame.
+*/
+class TileScheduler
+{
+public:
+    TileScheduler(unsigned workerCount, unsigned tileSize);
+
+    // split a width x height image into tiles and deal them out to the workers
+    void Reset(unsigned width, unsigned height);
+
+    // fetch the next tile for a worker. Returns false once every tile is taken
+    bool Next(unsigned worker, Tile& tile);
+
+    // number of tiles in the current frame
+    unsigned GetTileCount() const;
+
+private:
+    struct WorkQueue
+    {
+        Spinlock lock;
+        std::deque<Tile> tiles;
+    };
+
+    // try to take a tile from the front of another worker's deque
+    bool Steal(unsigned thief, Tile& tile);
+
+    std::unique_ptr<WorkQueue[]> queues;
+    const unsigned workerCount;
+    const unsigned tileSize;
+    unsigned tileCount = 0;
+};
+
+inline unsigned TileScheduler::GetTileCount() const
+{
+    return this->tileCount;
+}
@@ -1,71 +1,66 @@
 #pragma once
 #include <cmath>
-#include <initializer_list>
+#include <type_traits>
 #include <assert.h>
 
 #define MPI 3.14159265358979323846
 
+// build with TRAYRACER_DOUBLE_PRECISION to do all vector and matrix math in double
+#ifdef TRAYRACER_DOUBLE_PRECISION
+typedef double scalar;
+#else
+typedef float scalar;
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    Deliberately three plain scalars rather than a 16 byte SIMD register.
+    vec3 is mostly loaded and stored (rays, hit records, AABBs, the BVH
+    build's centroids) and an unused fourth lane would grow all of them by
+    a third.
+    A lone vec3 op also leaves three of four lanes idle. The hot loops get
+    their SIMD across many rays or primitives instead, see SphereStore,
+    RayPacket and the mat4 transforms.
+*/
 class vec3
 {
 public:
     vec3() : x(0), y(0), z(0){}
 
-    vec3(double x, double y, double z) : x(x), y(y), z(z){}
+    vec3(scalar x, scalar y, scalar z) : x(x), y(y), z(z){}
 
-    vec3(std::initializer_list<double> const il)
-    {
-        assert(il.size() == 3);
+    inline vec3 operator+(vec3 const& rhs) const { return {x + rhs.x, y + rhs.y, z + rhs.z};}
+    inline vec3 operator-(vec3 const& rhs) const { return {x - rhs.x, y - rhs.y, z - rhs.z};}
+    inline vec3 operator-() const { return {-x, -y, -z};}
+    inline vec3 operator*(scalar const c) const { return {x * c, y * c, z * c};}
 
-        int i = 0;
-        for (auto v : il)
-        {
-            double* d = reinterpret_cast<double*>(this);
-            d += i;
-            *d = v;
-            i++;
-        }
-
-    }
-
-    ~vec3()
-    {
-    }
-
-    vec3(vec3 const& rhs)
-    {
-        this->x = rhs.x;
-        this->y = rhs.y;
-        this->z = rhs.z;
-
-    }
-
-    inline vec3 operator+(vec3 const& rhs) { return {x + rhs.x, y + rhs.y, z + rhs.z};}
-    inline vec3 operator-(vec3 const& rhs) { return {x - rhs.x, y - rhs.y, z - rhs.z};}
-    inline vec3 operator-() { return {-x, -y, -z};}
-    inline vec3 operator*(float const c) { return {x * c, y * c, z * c};}
-
-    double x, y, z;
+    scalar x, y, z;
 
 };
 
+// vectors are copied around by value everywhere, keep that a plain memcpy
+static_assert(std::is_trivially_copyable<vec3>::value, "vec3 must be trivially copyable");
+static_assert(sizeof(vec3) == 3 * sizeof(scalar), "vec3 must be tightly packed");
+
 // Get length of 3D vector
-inline double len(vec3 const& v)
+inline scalar len(vec3 const& v)
 {
-    double a = v.x * v.x;
+    scalar a = v.x * v.x;
     a = a + v.y * v.y;
     a = a + v.z * v.z;
-    double l = sqrt(a);
+    scalar l = std::sqrt(a);
     return l;
 }
 
 // Get normalized version of v
 inline vec3 normalize(vec3 v)
 {
-    double l = len(v);
+    scalar l = len(v);
     if (l == 0)
         return vec3(0,0,0);
 
-    vec3 ret = vec3(v.x / l, v.y / l, v.z / l);
+    scalar invL = 1 / l;
+    vec3 ret = vec3(v.x * invL, v.y * invL, v.z * invL);
     return ret;
 }
 
@@ -81,7 +76,7 @@ inline vec3 add(vec3 a, vec3 b)
     return {a.x + b.x, a.y + b.y, a.z + b.z};
 }
 
-inline float dot(vec3 a, vec3 b)
+inline scalar dot(vec3 a, vec3 b)
 {
     return a.x * b.x + a.y * b.y + a.z * b.z;
 }
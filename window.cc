@@ -4,6 +4,9 @@
 //------------------------------------------------------------------------------
 #include "window.h"
 #include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include "profile.h"
 
 namespace Display
 {
@@ -54,6 +57,108 @@ GLDebugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei
 	}
 }
 
+//------------------------------------------------------------------------------
+/**
+	How a BlitFormat is stored on the GPU
+*/
+struct BlitFormatInfo
+{
+	GLenum internalFormat;
+	GLenum format;
+	GLenum type;
+	size_t bytesPerPixel;
+};
+
+static const BlitFormatInfo BlitFormats[] =
+{
+	{ GL_RGB32F, GL_RGB, GL_FLOAT, 12 },
+	{ GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8 },
+	{ GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+};
+
+//------------------------------------------------------------------------------
+/**
+	Round to nearest even, after Fabian Giesen's float_to_half_fast3_rtne.
+*/
+static uint16_t
+FloatToHalf(float value)
+{
+	const uint32_t infinity = 255u << 23;
+	const uint32_t halfOverflow = (127u + 16u) << 23;
+	const uint32_t denormMagicBits = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+	uint32_t f;
+	memcpy(&f, &value, sizeof(f));
+	const uint32_t sign = f & 0x80000000u;
+	f ^= sign;
+
+	uint16_t h;
+	if (f >= halfOverflow)
+	{
+		// too large, or inf or nan
+		h = f > infinity ? 0x7e00 : 0x7c00;
+	}
+	else if (f < (113u << 23))
+	{
+		// denormal, let the float adder do the rounding
+		float denormMagic, v;
+		memcpy(&denormMagic, &denormMagicBits, sizeof(float));
+		memcpy(&v, &f, sizeof(float));
+		v += denormMagic;
+		memcpy(&f, &v, sizeof(float));
+		h = uint16_t(f - denormMagicBits);
+	}
+	else
+	{
+		const uint32_t mantissaOdd = (f >> 13) & 1;
+		f -= (127u - 15u) << 23;
+		f += 0xfff + mantissaOdd;
+		h = uint16_t(f >> 13);
+	}
+	return h | uint16_t(sign >> 16);
+}
+
+//------------------------------------------------------------------------------
+/**
+	Writes strictly front to back, the destination may be write combined memory.
+*/
+static void
+PackPixels(float const* src, size_t pixelCount, BlitFormat format, void* dst)
+{
+	switch (format)
+	{
+	case BlitFloat:
+		memcpy(dst, src, pixelCount * 3 * sizeof(float));
+		break;
+	case BlitHalf:
+	{
+		uint16_t* out = (uint16_t*)dst;
+		for (size_t i = 0; i < pixelCount; ++i, src += 3, out += 4)
+		{
+			out[0] = FloatToHalf(src[0]);
+			out[1] = FloatToHalf(src[1]);
+			out[2] = FloatToHalf(src[2]);
+			out[3] = 0x3c00;
+		}
+		break;
+	}
+	case BlitRGBA8:
+	{
+		uint32_t* out = (uint32_t*)dst;
+		for (size_t i = 0; i < pixelCount; ++i, src += 3)
+		{
+			const uint32_t r = uint32_t(std::min(std::max(src[0], 0.0f), 1.0f) * 255.0f + 0.5f);
+			const uint32_t g = uint32_t(std::min(std::max(src[1], 0.0f), 1.0f) * 255.0f + 0.5f);
+			const uint32_t b = uint32_t(std::min(std::max(src[2], 0.0f), 1.0f) * 255.0f + 0.5f);
+			// bytes in memory are r g b a
+			unsigned char bytes[4] = { (unsigned char)r, (unsigned char)g, (unsigned char)b, 255 };
+			memcpy(out + i, bytes, 4);
+		}
+		break;
+	}
+	}
+}
+
 int32_t Window::WindowCount = 0;
 //------------------------------------------------------------------------------
 /**
@@ -234,19 +339,8 @@ Window::Open()
 
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-	// Framebuffer setup
+	// Framebuffer setup, the texture is attached by the first Blit once the image size is known
     glGenFramebuffers(1, &frameCopy);
-    glBindFramebuffer(GL_FRAMEBUFFER, frameCopy);
-
-    glGenTextures(1, &texture);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0);
 
 	// increase window count and return result
 	Window::WindowCount++;
@@ -260,7 +354,11 @@ void
 Window::Close()
 {
 	if (nullptr != this->window)
+	{
+		this->DiscardBlitTarget();
+		glDeleteFramebuffers(1, &this->frameCopy);
 		glfwDestroyWindow(this->window);
+	}
 
 	this->window = nullptr;
 	Window::WindowCount--;
@@ -302,22 +400,138 @@ Window::SwapBuffers()
 
 //------------------------------------------------------------------------------
 /**
+	Texture storage is immutable when the driver allows it, so a new size
+	or format means a new texture. The upload buffer is mapped once and
+	stays mapped; without buffer storage Blit falls back to uploading from
+	client memory.
+*/
+void
+Window::SetupBlitTarget(int32_t w, int32_t h)
+{
+	this->DiscardBlitTarget();
+	BlitFormatInfo const& info = BlitFormats[this->blitFormat];
+
+	glGenTextures(1, &this->texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, this->texture);
+	if (GLEW_ARB_texture_storage)
+		glTexStorage2D(GL_TEXTURE_2D, 1, info.internalFormat, w, h);
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, info.internalFormat, w, h, 0, info.format, info.type, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, this->frameCopy);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, this->texture, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	this->uploadSliceSize = size_t(w) * h * info.bytesPerPixel;
+	if (GLEW_ARB_buffer_storage)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		const GLsizeiptr size = GLsizeiptr(this->uploadSliceSize * UploadRingSize);
+		glGenBuffers(1, &this->uploadBuffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->uploadBuffer);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, size, nullptr, flags);
+		this->uploadMapping = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, flags);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	if (this->uploadMapping == nullptr)
+		this->staging.resize(this->uploadSliceSize);
+
+	this->blitWidth = w;
+	this->blitHeight = h;
+	this->blitTargetFormat = this->blitFormat;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Window::DiscardBlitTarget()
+{
+	for (GLsync& fence : this->uploadFences)
+	{
+		if (fence != nullptr)
+			glDeleteSync(fence);
+		fence = nullptr;
+	}
+	if (this->uploadBuffer != 0)
+	{
+		if (this->uploadMapping != nullptr)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->uploadBuffer);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &this->uploadBuffer);
+	}
+	if (this->texture != 0)
+		glDeleteTextures(1, &this->texture);
+
+	this->uploadBuffer = 0;
+	this->uploadMapping = nullptr;
+	this->uploadSlice = 0;
+	this->texture = 0;
+	this->staging.clear();
+	this->blitWidth = 0;
+	this->blitHeight = 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+	Packs the pixels straight into a slice of the mapped upload buffer and
+	copies from there to the texture on the GPU's time. A slice is reused
+	three frames later, and only waited for if the GPU still hasn't read it.
 */
 void
 Window::Blit(float const* data, int w, int h)
 {
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_FLOAT, (void*)data);
+	PROFILE_SCOPE("Blit");
+	PROFILE_TIME(TimerBlit);
+	if (w != this->blitWidth || h != this->blitHeight || this->blitFormat != this->blitTargetFormat)
+		this->SetupBlitTarget(w, h);
+
+	BlitFormatInfo const& info = BlitFormats[this->blitTargetFormat];
+	glBindTexture(GL_TEXTURE_2D, this->texture);
+	if (this->uploadMapping != nullptr)
+	{
+		GLsync& fence = this->uploadFences[this->uploadSlice];
+		if (fence != nullptr)
+		{
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+			glDeleteSync(fence);
+		}
+
+		const size_t offset = this->uploadSliceSize * this->uploadSlice;
+		PackPixels(data, size_t(w) * h, this->blitTargetFormat, (char*)this->uploadMapping + offset);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, this->uploadBuffer);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, info.format, info.type, (void*)offset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		this->uploadSlice = (this->uploadSlice + 1) % UploadRingSize;
+	}
+	else
+	{
+		PackPixels(data, size_t(w) * h, this->blitTargetFormat, this->staging.data());
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, info.format, info.type, this->staging.data());
+	}
 	glBindTexture(GL_TEXTURE_2D, 0);
-	
-    //glBlitNamedFramebuffer(frameCopy, NULL, 0, 0, w, h, 0, 0, this->width, this->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
+	// the pixels are sRGB encoded already, the blit must not encode them again
+	glDisable(GL_FRAMEBUFFER_SRGB);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, frameCopy);
 	glBlitFramebuffer(0, 0, w, h, 0, 0, this->width, this->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-	
+	glEnable(GL_FRAMEBUFFER_SRGB);
+
 	// switch back to default read buffer
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 }
 
-} // namespace Display
\ No newline at end of file
+} // namespace Display
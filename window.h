@@ -10,9 +10,21 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <string>
+#include <vector>
 
 namespace Display
 {
+/// formats Blit can stream pixels to the GPU in
+enum BlitFormat
+{
+	/// 32 bit float RGB, 12 bytes per pixel
+	BlitFloat,
+	/// 16 bit float RGBA, 8 bytes per pixel
+	BlitHalf,
+	/// 8 bit RGBA, 4 bytes per pixel. Plenty for tonemapped sRGB
+	BlitRGBA8
+};
+
 class Window
 {
 public:
@@ -55,7 +67,9 @@ public:
 	void SetMouseScrollFunction(const std::function<void(double, double)>& func);
     /// set window resize function callback
     void SetWindowResizeFunction(const std::function<void(int32_t, int32_t)>& func);
-	/// bit block transfer from buffer to screen. data buffer must be exactly w * h * 3 large!
+	/// set the format Blit packs pixels into before uploading them, RGBA8 by default
+	void SetBlitFormat(BlitFormat format);
+	/// bit block transfer from sRGB encoded buffer to screen. data buffer must be exactly w * h * 3 large!
 	void Blit(float const* data, int w, int h);
 
 private:
@@ -77,6 +91,10 @@ private:
 	void Resize();
 	/// title rename update
 	void Retitle(); 
+	/// (re)create the texture and upload buffers for w x h images in the blit format
+	void SetupBlitTarget(int32_t w, int32_t h);
+	/// free the texture and upload buffers
+	void DiscardBlitTarget();
 
 	static int32_t WindowCount;
 
@@ -100,9 +118,37 @@ private:
 
 private:
 	GLuint frameCopy;
-    GLuint texture;
+    GLuint texture = 0;
+
+	/// uploads in flight, each with its own slice of the upload buffer
+	static const int32_t UploadRingSize = 3;
+
+	BlitFormat blitFormat = BlitRGBA8;
+	/// size and format the texture was created for
+	int32_t blitWidth = 0;
+	int32_t blitHeight = 0;
+	BlitFormat blitTargetFormat = BlitRGBA8;
+
+	/// persistently mapped pixel unpack buffer, split into UploadRingSize slices
+	GLuint uploadBuffer = 0;
+	void* uploadMapping = nullptr;
+	size_t uploadSliceSize = 0;
+	/// signalled once the GPU is done reading a slice
+	GLsync uploadFences[UploadRingSize] = {};
+	int32_t uploadSlice = 0;
+	/// packed pixels when persistent mapping is not supported
+	std::vector<unsigned char> staging;
 };
 
+//------------------------------------------------------------------------------
+/**
+*/
+inline void
+Window::SetBlitFormat(BlitFormat format)
+{
+	this->blitFormat = format;
+}
+
 //------------------------------------------------------------------------------
 /**
 */